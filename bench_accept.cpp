@@ -0,0 +1,147 @@
+#include "ps_net.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+// how fast a burst of clients gets from connecting to validated: one acceptor taking a connection per wakeup,
+// one acceptor draining the burst, and an SO_REUSEPORT acceptor per io thread.
+// the burst size is the first argument, 50000 if there isn't one
+enum class BenchMsg : uint32_t {
+    None
+};
+
+class AcceptServer : public ps::net::server_interface<BenchMsg> {
+public:
+    AcceptServer(uint16_t port, size_t threads) : ps::net::server_interface<BenchMsg>(port, threads) {}
+
+protected:
+    bool OnClientConnect(std::shared_ptr<connection_type>) override {
+        return true;
+    }
+};
+
+constexpr size_t io_threads = 4;
+constexpr size_t connector_threads = 4;
+
+// handshakes each connector keeps going at once, so the burst isn't limited by the file descriptors it would
+// take to hold every connection open
+constexpr size_t connector_window = 256;
+
+// a run that hasn't validated the whole burst by then is reported as far as it got
+constexpr std::chrono::seconds run_timeout{60};
+
+// one client's handshake on a bare socket, a client_interface (and its thread) per connection would cost more than the accept
+struct handshake {
+    explicit handshake(asio::io_context& context) : socket(context) {}
+
+    asio::ip::tcp::socket socket;
+    uint64_t value = 0;
+};
+
+// connect, answer the server's handshake and hang up, then start the next one until remaining runs out.
+// the server counts the client as validated as soon as it has read the answer
+static void Handshake(asio::io_context& context, const asio::ip::tcp::endpoint& endpoint, size_t& remaining) {
+    if (remaining == 0) {
+        return;
+    }
+    remaining--;
+
+    auto client = std::make_shared<handshake>(context);
+    client->socket.async_connect(endpoint, [&context, &endpoint, &remaining, client](std::error_code ec) {
+        if (ec) {
+            Handshake(context, endpoint, remaining);
+            return;
+        }
+        asio::async_read(client->socket, asio::buffer(&client->value, sizeof(uint64_t)), [&context, &endpoint, &remaining, client](std::error_code ec, std::size_t) {
+            if (ec) {
+                Handshake(context, endpoint, remaining);
+                return;
+            }
+            client->value = ps::net::connection<BenchMsg>::HandshakeAnswer(client->value);
+            asio::async_write(client->socket, asio::buffer(&client->value, sizeof(uint64_t)), [&context, &endpoint, &remaining, client](std::error_code, std::size_t) {
+                Handshake(context, endpoint, remaining);
+            });
+        });
+    });
+}
+
+struct result {
+    double rate;
+    double seconds;
+    uint64_t validated;
+    uint64_t wakeups;
+};
+
+static result Run(uint16_t port, ps::net::accept_mode mode, size_t batch, size_t burst) {
+    AcceptServer server(port, io_threads);
+    server.SetAcceptMode(mode, batch);
+    if (!server.Start()) {
+        return {0, 0, 0, 0};
+    }
+
+    // disconnects are handled (and the clients dropped) as they come in
+    std::atomic<bool> running{true};
+    std::thread updater([&]() {
+        while (running.load(std::memory_order_relaxed)) {
+            server.Update(std::numeric_limits<size_t>::max(), false);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+
+    const auto& stats = server.GetAcceptStats();
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> connectors;
+    for (size_t i = 0; i < connector_threads; i++) {
+        size_t share = burst / connector_threads + (i < burst % connector_threads ? 1 : 0);
+        connectors.emplace_back([port, share]() {
+            asio::io_context context;
+            asio::ip::tcp::endpoint endpoint(asio::ip::make_address("127.0.0.1"), port);
+            size_t remaining = share;
+            for (size_t n = 0; n < connector_window; n++) {
+                Handshake(context, endpoint, remaining);
+            }
+            context.run();
+        });
+    }
+
+    auto deadline = start + run_timeout;
+    while (stats.validated.load() < burst && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    uint64_t validated = stats.validated.load();
+    if (validated < burst) {
+        std::printf("timed out with %llu of %zu clients validated\n", (unsigned long long)validated, burst);
+    }
+
+    result r{double(validated) / seconds, seconds, validated, stats.wakeups.load()};
+
+    // after a timeout the connectors may still be waiting on the server, stopping it lets them finish
+    running = false;
+    updater.join();
+    server.Stop();
+    for (auto& t : connectors) {
+        t.join();
+    }
+    return r;
+}
+
+int main(int argc, char** argv) {
+    size_t burst = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 50000;
+
+    // below the ephemeral ranges, so the connectors' own TIME_WAIT sockets can't be holding the next run's port
+    result one = Run(30500, ps::net::accept_mode::single, 1, burst);
+    result drained = Run(30501, ps::net::accept_mode::single, 64, burst);
+    result reuse = Run(30502, ps::net::accept_mode::reuse_port, 64, burst);
+
+    std::printf("\n%zu clients from %zu threads (%zu handshakes in flight each), %zu io threads, %u hardware threads\n",
+                burst, connector_threads, connector_window, io_threads, std::thread::hardware_concurrency());
+    std::printf("acceptor                 validated/s   seconds   validated   wakeups\n");
+    for (auto& [name, r] : {std::pair{"single, one per wakeup", one}, std::pair{"single, drain up to 64", drained}, std::pair{"reuse_port per thread ", reuse}}) {
+        std::printf("%s   %11.0f   %7.2f   %9llu   %7llu\n", name, r.rate, r.seconds, (unsigned long long)r.validated, (unsigned long long)r.wakeups);
+    }
+    return 0;
+}
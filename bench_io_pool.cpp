@@ -0,0 +1,102 @@
+#include "ps_net.h"
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// echo throughput with the server's connections spread over 1, 2, 4 and 8 io threads
+enum class BenchMsg : uint32_t {
+    Echo
+};
+
+class EchoServer : public ps::net::server_interface<BenchMsg> {
+public:
+    EchoServer(uint16_t port, size_t threads) : ps::net::server_interface<BenchMsg>(port, threads) {}
+
+protected:
+    bool OnClientConnect(std::shared_ptr<connection_type>) override {
+        return true;
+    }
+
+    void OnMessage(std::shared_ptr<connection_type> client, ps::net::message<BenchMsg>& msg) override {
+        client->Send(msg);
+    }
+};
+
+constexpr size_t client_count = 16;
+constexpr size_t messages_per_client = 20000;
+constexpr size_t window = 256;
+
+static double Run(uint16_t port, size_t threads) {
+    EchoServer server(port, threads);
+    if (!server.Start()) {
+        return 0;
+    }
+
+    std::atomic<bool> running{true};
+    std::thread updater([&]() {
+        while (running.load(std::memory_order_relaxed)) {
+            server.Update(std::numeric_limits<size_t>::max(), false);
+            std::this_thread::yield();
+        }
+    });
+
+    std::vector<std::unique_ptr<ps::net::client_interface<BenchMsg>>> clients;
+    for (size_t i = 0; i < client_count; i++) {
+        clients.push_back(std::make_unique<ps::net::client_interface<BenchMsg>>());
+        clients.back()->Connect("127.0.0.1", port);
+    }
+    while (server.ClientCount() < client_count) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    ps::net::message<BenchMsg> msg;
+    msg.header.id = BenchMsg::Echo;
+    msg << uint64_t{0} << uint64_t{0} << uint64_t{0} << uint64_t{0};
+    auto shared = ps::net::make_shared_message(msg);
+
+    // every client keeps up to window messages in flight until it has had all of them back
+    std::vector<size_t> sent(client_count, 0);
+    std::vector<size_t> received(client_count, 0);
+    size_t done = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (done < client_count) {
+        for (size_t i = 0; i < client_count; i++) {
+            while (sent[i] < messages_per_client && sent[i] - received[i] < window && clients[i]->Send(shared)) {
+                sent[i]++;
+            }
+            size_t before = received[i];
+            received[i] += clients[i]->Incoming().drain([](ps::net::owned_message<BenchMsg>&&) {});
+            if (before < messages_per_client && received[i] >= messages_per_client) {
+                done++;
+            }
+        }
+        std::this_thread::yield();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    running = false;
+    updater.join();
+    for (auto& client : clients) {
+        client->Disconnect();
+    }
+    server.Stop();
+    return double(client_count * messages_per_client) / seconds;
+}
+
+int main() {
+    std::vector<std::pair<size_t, double>> results;
+    // below the ephemeral ranges, so a client socket left in TIME_WAIT can't be holding the next run's port
+    uint16_t port = 30400;
+    for (size_t threads : {1, 2, 4, 8}) {
+        results.push_back({threads, Run(port++, threads)});
+    }
+
+    std::printf("\nio threads   echoes/s   (%zu clients, %zu echoes each, %u hardware threads)\n",
+                client_count, messages_per_client, std::thread::hardware_concurrency());
+    for (auto& [threads, rate] : results) {
+        std::printf("%10zu   %8.0f\n", threads, rate);
+    }
+    return 0;
+}
@@ -0,0 +1,308 @@
+#include "ps_net.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <thread>
+#include <vector>
+
+// what building and handing out messages costs on the calling thread, in heap allocations and time
+enum class BenchMsg : uint32_t {
+    Data
+};
+
+// every allocation made by a thread that has counting switched on, and the bytes asked for
+static std::atomic<uint64_t> allocations{0};
+static std::atomic<uint64_t> allocatedBytes{0};
+static thread_local bool counting = false;
+
+// every form of new and delete goes through these two, so a block is always freed the way it was allocated
+static void* Allocate(size_t size, size_t alignment) {
+    if (counting) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    }
+    alignment = std::max(alignment, size_t(__STDCPP_DEFAULT_NEW_ALIGNMENT__));
+#ifdef _WIN32
+    return _aligned_malloc(size ? size : 1, alignment);
+#else
+    void* p = nullptr;
+    return posix_memalign(&p, alignment, size ? size : 1) == 0 ? p : nullptr;
+#endif
+}
+
+static void Release(void* p) noexcept {
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+static void* AllocateOrThrow(size_t size, size_t alignment) {
+    if (void* p = Allocate(size, alignment)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size) { return AllocateOrThrow(size, 0); }
+void* operator new[](size_t size) { return AllocateOrThrow(size, 0); }
+void* operator new(size_t size, std::align_val_t alignment) { return AllocateOrThrow(size, size_t(alignment)); }
+void* operator new[](size_t size, std::align_val_t alignment) { return AllocateOrThrow(size, size_t(alignment)); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return Allocate(size, 0); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return Allocate(size, 0); }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return Allocate(size, size_t(alignment)); }
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return Allocate(size, size_t(alignment)); }
+
+void operator delete(void* p) noexcept { Release(p); }
+void operator delete[](void* p) noexcept { Release(p); }
+void operator delete(void* p, size_t) noexcept { Release(p); }
+void operator delete[](void* p, size_t) noexcept { Release(p); }
+void operator delete(void* p, std::align_val_t) noexcept { Release(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { Release(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { Release(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { Release(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { Release(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { Release(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { Release(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { Release(p); }
+
+struct allocation_count {
+    uint64_t calls;
+    uint64_t bytes;
+};
+
+// allocations made by fn on this thread
+template <typename F>
+static allocation_count CountAllocations(F&& fn) {
+    uint64_t calls = allocations.load();
+    uint64_t bytes = allocatedBytes.load();
+    counting = true;
+    fn();
+    counting = false;
+    return {allocations.load() - calls, allocatedBytes.load() - bytes};
+}
+
+class FanoutServer : public ps::net::server_interface<BenchMsg> {
+public:
+    FanoutServer(uint16_t port) : ps::net::server_interface<BenchMsg>(port) {}
+
+    // every validated client, for sending to each one on its own
+    std::vector<uint32_t> ids;
+
+protected:
+    bool OnClientConnect(std::shared_ptr<ps::net::connection<BenchMsg>>) override {
+        return true;
+    }
+
+    void OnClientValidated(std::shared_ptr<ps::net::connection<BenchMsg>> client) override {
+        ids.push_back(client->GetID());
+    }
+
+    void OnMessage(std::shared_ptr<ps::net::connection<BenchMsg>>, ps::net::message<BenchMsg>&) override {}
+};
+
+// allocations per recipient when one 1 KiB message is broadcast to every client, against sending
+// every client its own copy
+static void Fanout() {
+    constexpr size_t client_count = 64;
+    constexpr size_t broadcasts = 100;
+
+    // below the ephemeral ranges, so a client socket left in TIME_WAIT can't be holding the port
+    FanoutServer server(30600);
+    if (!server.Start()) {
+        return;
+    }
+    std::vector<std::unique_ptr<ps::net::client_interface<BenchMsg>>> clients;
+    for (size_t i = 0; i < client_count; i++) {
+        clients.push_back(std::make_unique<ps::net::client_interface<BenchMsg>>());
+        clients.back()->Connect("127.0.0.1", 30600);
+    }
+
+    // let every handshake finish
+    for (int i = 0; i < 50; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        server.Update();
+    }
+
+    ps::net::message<BenchMsg> msg;
+    msg.header.id = BenchMsg::Data;
+    msg.body.resize(1024);
+    msg.header.size = uint32_t(msg.body.size());
+
+    allocation_count shared = CountAllocations([&]() {
+        for (size_t i = 0; i < broadcasts; i++) {
+            server.MessageAllClients(msg);
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    allocation_count copied = CountAllocations([&]() {
+        for (size_t i = 0; i < broadcasts; i++) {
+            for (uint32_t id : server.ids) {
+                server.MessageClient(id, msg);
+            }
+        }
+    });
+
+    double recipients = double(broadcasts * server.ids.size());
+    std::printf("fan-out to %zu clients, 1 KiB body     allocations   bytes (per recipient)\n", server.ids.size());
+    std::printf("MessageAllClients, shared            %11.2f   %5.0f\n", double(shared.calls) / recipients, double(shared.bytes) / recipients);
+    std::printf("MessageClient each, copied           %11.2f   %5.0f\n", double(copied.calls) / recipients, double(copied.bytes) / recipients);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    for (auto& client : clients) {
+        client->Disconnect();
+    }
+    server.Stop();
+}
+
+// allocations to build, copy and take apart a message with a 16 byte body
+static void SmallBodies() {
+    constexpr size_t messages = 100000;
+
+    allocation_count count = CountAllocations([&]() {
+        for (size_t i = 0; i < messages; i++) {
+            ps::net::message<BenchMsg> msg;
+            msg.header.id = BenchMsg::Data;
+            msg << uint32_t(i) << float(1.5f) << uint64_t(i * 3);
+
+            ps::net::message<BenchMsg> copy = msg;
+            uint64_t a;
+            float b;
+            uint32_t c;
+            copy >> a >> b >> c;
+        }
+    });
+    std::printf("16 byte body, built, copied and pulled: %.2f allocations, %.0f bytes per message\n",
+                double(count.calls) / double(messages), double(count.bytes) / double(messages));
+}
+
+// heap allocations per message when a 256 byte reply is built and shared the way MessageAllClients(msg) shares
+// it, from the tick arena (CreateMessage) against the heap. the shared copy is dropped straight away, as if written
+static void Arena() {
+    constexpr size_t ticks = 1000;
+    constexpr size_t per_tick = 100;
+
+    // never started, only its arena is used
+    FanoutServer server(30601);
+
+    allocation_count heap = CountAllocations([&]() {
+        for (size_t t = 0; t < ticks; t++) {
+            for (size_t i = 0; i < per_tick; i++) {
+                ps::net::message<BenchMsg> msg;
+                msg.header.id = BenchMsg::Data;
+                msg.body.resize(256);
+                auto shared = ps::net::make_shared_copy(msg);
+            }
+        }
+    });
+    allocation_count arena = CountAllocations([&]() {
+        for (size_t t = 0; t < ticks; t++) {
+            for (size_t i = 0; i < per_tick; i++) {
+                ps::net::message<BenchMsg> msg = server.CreateMessage(BenchMsg::Data);
+                msg.body.resize(256);
+                auto shared = ps::net::make_shared_copy(msg);
+            }
+            server.Update();
+        }
+    });
+
+    const auto& stats = server.GetArenaStats();
+    double messages = double(ticks * per_tick);
+    std::printf("256 byte body, built and shared     allocations   bytes (per message)\n");
+    std::printf("heap                                %11.2f   %5.0f\n", double(heap.calls) / messages, double(heap.bytes) / messages);
+    std::printf("CreateMessage, tick arena           %11.2f   %5.0f\n", double(arena.calls) / messages, double(arena.bytes) / messages);
+    std::printf("arena: %llu blocks, %llu bytes, %llu chunk mallocs, %llu arenas recycled over %zu ticks\n",
+                (unsigned long long)stats.allocations.load(), (unsigned long long)stats.bytes.load(),
+                (unsigned long long)stats.chunk_mallocs.load(), (unsigned long long)stats.recycled.load(), ticks);
+}
+
+static uint32_t Swap(uint32_t x) {
+    return (x >> 24) | ((x >> 8) & 0xff00) | ((x << 8) & 0xff0000) | (x << 24);
+}
+
+// nanoseconds per element to push an array of uint32_t into a message and pull it back out
+template <typename F>
+static double TimePerElement(size_t elements, F&& fn) {
+    size_t reps = std::max<size_t>(1, (size_t(1) << 24) / elements);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < reps; r++) {
+        fn();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return seconds * 1e9 / double(reps * elements);
+}
+
+// one element at a time against the whole array in one copy, in host and network byte order
+static void BulkArrays() {
+    std::printf("elements   per element   bulk   per element (network)   bulk (network)   (ns per element pushed and pulled)\n");
+    for (size_t elements : {size_t(16), size_t(1024), size_t(64 * 1024)}) {
+        std::vector<uint32_t> in(elements);
+        for (size_t i = 0; i < elements; i++) {
+            in[i] = uint32_t(i * 2654435761u);
+        }
+        std::vector<uint32_t> out(elements);
+        volatile uint32_t sink = 0;
+
+        double single = TimePerElement(elements, [&]() {
+            ps::net::message<BenchMsg> msg;
+            for (uint32_t x : in) {
+                msg << x;
+            }
+            for (size_t i = elements; i-- > 0;) {
+                msg >> out[i];
+            }
+            sink = sink + out[elements - 1];
+        });
+        double bulk = TimePerElement(elements, [&]() {
+            ps::net::message<BenchMsg> msg;
+            msg << in;
+            msg >> out;
+            sink = sink + out[elements - 1];
+        });
+        double singleSwapped = TimePerElement(elements, [&]() {
+            ps::net::message<BenchMsg> msg;
+            for (uint32_t x : in) {
+                msg << Swap(x);
+            }
+            for (size_t i = elements; i-- > 0;) {
+                uint32_t x;
+                msg >> x;
+                out[i] = Swap(x);
+            }
+            sink = sink + out[elements - 1];
+        });
+        double bulkSwapped = TimePerElement(elements, [&]() {
+            ps::net::message<BenchMsg> msg;
+            msg << ps::net::network_order(in);
+            msg >> ps::net::network_order(out);
+            sink = sink + out[elements - 1];
+        });
+
+        std::printf("%8zu   %11.2f   %4.2f   %21.2f   %14.2f\n", elements, single, bulk, singleSwapped, bulkSwapped);
+        if (out != in) {
+            std::printf("the array didn't come back the same\n");
+        }
+    }
+}
+
+// runs every section, or just the one named on the command line (fanout, small, arena or bulk)
+int main(int argc, char** argv) {
+    std::string only = argc > 1 ? argv[1] : "";
+    if (only.empty() || only == "fanout") {
+        Fanout();
+    }
+    if (only.empty() || only == "small") {
+        SmallBodies();
+    }
+    if (only.empty() || only == "arena") {
+        Arena();
+    }
+    if (only.empty() || only == "bulk") {
+        BulkArrays();
+    }
+    return 0;
+}
@@ -0,0 +1,69 @@
+#include "net_mpsc_queue.h"
+#include "net_tsqueue.h"
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+// many producers pushing into one consumer, the lock-free ring against the mutex queue it replaced
+struct item {
+    uint32_t producer;
+    uint64_t sequence;
+};
+
+constexpr size_t total_items = 2000000;
+
+template <typename Queue>
+static double Run(Queue& queue, size_t producers) {
+    size_t each = total_items / producers;
+    std::atomic<bool> go{false};
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < producers; p++) {
+        threads.emplace_back([&queue, &go, p, each]() {
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            for (uint64_t i = 0; i < each; i++) {
+                queue.push_back({uint32_t(p), i});
+            }
+        });
+    }
+
+    // both consumers poll, tsqueue::wait can miss the last push and would hang the run
+    std::vector<uint64_t> next(producers, 0);
+    size_t received = 0;
+    bool ordered = true;
+    auto start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    while (received < each * producers) {
+        if (queue.empty()) {
+            std::this_thread::yield();
+            continue;
+        }
+        item x = queue.pop_front();
+        ordered = ordered && x.sequence == next[x.producer]++;
+        received++;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (auto& t : threads) {
+        t.join();
+    }
+    if (!ordered) {
+        std::printf("a producer's items arrived out of order\n");
+    }
+    return double(received) / seconds / 1e6;
+}
+
+int main() {
+    std::printf("producers   mpsc_queue   tsqueue   (million items/s, %zu items, %u hardware threads)\n",
+                total_items, std::thread::hardware_concurrency());
+    for (size_t producers : {1, 2, 4, 8, 16}) {
+        ps::net::mpsc_queue<item> ring;
+        ps::net::tsqueue<item> locked;
+        double a = Run(ring, producers);
+        double b = Run(locked, producers);
+        std::printf("%9zu   %10.2f   %7.2f\n", producers, a, b);
+    }
+    return 0;
+}
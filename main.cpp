@@ -39,13 +39,13 @@ protected:
             } break;
             case CustomMsgTypes::MessageAll: {
                 std::cout << "[" << client->GetID() << "]: message all\n";
-                ps::net::message<CustomMsgTypes> out_msg;
-                out_msg.header.id = CustomMsgTypes::ServerMessage;
+                ps::net::message<CustomMsgTypes> out_msg = CreateMessage(CustomMsgTypes::ServerMessage);
                 out_msg << client->GetID();
                 MessageAllClients(out_msg, client);
             } break;
             case CustomMsgTypes::ChatMessageAll: {
-                MessageAllClients(msg);
+                // the incoming message isn't needed after this, so hand its body over instead of copying it
+                MessageAllClients(ps::net::make_shared_message(std::move(msg)));
             } break;
         }
     }
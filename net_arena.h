@@ -0,0 +1,146 @@
+// Created by psdab on 5/2/2024.
+
+#ifndef BETTER_SERVER_NET_ARENA_H
+#define BETTER_SERVER_NET_ARENA_H
+#pragma once
+
+#include "net_common.h"
+
+#include <atomic>
+#include <memory_resource>
+
+namespace ps {
+    namespace net {
+        // counters for the outbound message arenas, readable from any thread
+        struct arena_stats {
+            std::atomic<uint64_t> allocations{0};    // blocks handed out by an arena instead of the heap
+            std::atomic<uint64_t> bytes{0};          // bytes handed out by an arena
+            std::atomic<uint64_t> chunk_mallocs{0};  // times an arena had to get more memory from the heap
+            std::atomic<uint64_t> recycled{0};       // times a whole arena was reset for reuse
+        };
+
+        // bump allocator for everything built during one tick. individual frees only count down the
+        // number of live blocks, and once that reaches zero the whole arena can be reset in one step
+        // with its chunks kept for the next tick. allocation is single threaded (the thread calling
+        // Update), frees can come from any thread (the io thread drops a message once it is written)
+        class tick_arena : public std::pmr::memory_resource {
+        public:
+            tick_arena(size_t chunkSize, arena_stats& stats) : chunkSize(chunkSize), stats(stats) {}
+
+            tick_arena(const tick_arena&) = delete;
+            tick_arena& operator=(const tick_arena&) = delete;
+
+            ~tick_arena() override {
+                for (auto& chunk : chunks) {
+                    ::operator delete(chunk.memory);
+                }
+            }
+
+            // true when nothing allocated from the arena is still alive
+            bool idle() const {
+                return outstanding.load(std::memory_order_acquire) == 0;
+            }
+
+            // start bumping from the beginning again, only valid while idle()
+            void reset() {
+                if (chunkIndex != 0 || offset != 0) {
+                    stats.recycled.fetch_add(1, std::memory_order_relaxed);
+                }
+                chunkIndex = 0;
+                offset = 0;
+            }
+
+        private:
+            struct chunk {
+                uint8_t* memory;
+                size_t size;
+            };
+
+            void* do_allocate(size_t bytes, size_t alignment) override {
+                while (true) {
+                    if (chunkIndex < chunks.size()) {
+                        chunk& current = chunks[chunkIndex];
+                        size_t start = (offset + alignment - 1) & ~(alignment - 1);
+                        if (start + bytes <= current.size) {
+                            offset = start + bytes;
+                            outstanding.fetch_add(1, std::memory_order_relaxed);
+                            stats.allocations.fetch_add(1, std::memory_order_relaxed);
+                            stats.bytes.fetch_add(bytes, std::memory_order_relaxed);
+                            return current.memory + start;
+                        }
+
+                        // this chunk is full, move on to the next one (kept from earlier ticks if there is one)
+                        chunkIndex++;
+                        offset = 0;
+                        continue;
+                    }
+
+                    // out of chunks, so this is the only time the arena itself touches the heap
+                    size_t size = std::max(chunkSize, bytes + alignment);
+                    chunks.push_back({static_cast<uint8_t*>(::operator new(size)), size});
+                    stats.chunk_mallocs.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+
+            void do_deallocate(void*, size_t, size_t) override {
+                outstanding.fetch_sub(1, std::memory_order_release);
+            }
+
+            bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+                return this == &other;
+            }
+
+            size_t chunkSize;
+            arena_stats& stats;
+            std::vector<chunk> chunks;
+            size_t chunkIndex = 0;
+            size_t offset = 0;
+            std::atomic<size_t> outstanding{0};
+        };
+
+        // the set of tick arenas belonging to one server. each call to NextTick moves to an arena
+        // that nothing references any more, so in steady state building messages does no malloc/free at all.
+        // an arena that is still being written out (or was kept by a handler) is simply skipped until it drains
+        class message_arena {
+        public:
+            explicit message_arena(size_t chunkSize = 64 * 1024) : chunkSize(chunkSize) {
+                arenas.push_back(std::make_unique<tick_arena>(chunkSize, stats));
+            }
+
+            std::pmr::memory_resource* resource() {
+                return arenas[current].get();
+            }
+
+            void NextTick() {
+                // the common case: everything from the last tick has already been written
+                if (arenas[current]->idle()) {
+                    arenas[current]->reset();
+                    return;
+                }
+
+                for (size_t i = 0; i < arenas.size(); i++) {
+                    if (i != current && arenas[i]->idle()) {
+                        arenas[i]->reset();
+                        current = i;
+                        return;
+                    }
+                }
+
+                arenas.push_back(std::make_unique<tick_arena>(chunkSize, stats));
+                current = arenas.size() - 1;
+            }
+
+            const arena_stats& Stats() const {
+                return stats;
+            }
+
+        private:
+            size_t chunkSize;
+            arena_stats stats;
+            std::vector<std::unique_ptr<tick_arena>> arenas;
+            size_t current = 0;
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,183 @@
+// Created by psdab on 5/2/2024.
+
+#ifndef BETTER_SERVER_NET_BUFFER_H
+#define BETTER_SERVER_NET_BUFFER_H
+#pragma once
+
+#include "net_common.h"
+
+#include <cstring>
+#include <memory_resource>
+
+namespace ps {
+    namespace net {
+        // byte container for message bodies. the first InlineCapacity bytes live inside the
+        // object itself, so small messages (pings, ids, short updates) never touch the heap,
+        // and only payloads that outgrow it fall back to a heap allocation.
+        // it has the subset of the std::vector<uint8_t> interface the library uses.
+        // heap blocks come from the given memory resource if there is one, otherwise from new[].
+        // a copy goes back to new[] unless it is given a resource of its own, so copying a body built in an
+        // arena that only one thread may allocate from is safe on any thread
+        template <size_t InlineCapacity>
+        class body_buffer {
+        public:
+            using value_type = uint8_t;
+            using size_type = size_t;
+            using iterator = uint8_t*;
+            using const_iterator = const uint8_t*;
+
+            body_buffer() = default;
+
+            explicit body_buffer(std::pmr::memory_resource* resource) : memory(resource) {}
+
+            body_buffer(const body_buffer& other) {
+                assign(other.data(), other.size());
+            }
+
+            body_buffer(const body_buffer& other, std::pmr::memory_resource* resource) : memory(resource) {
+                assign(other.data(), other.size());
+            }
+
+            body_buffer(body_buffer&& other) noexcept {
+                take(other);
+            }
+
+            body_buffer& operator=(const body_buffer& other) {
+                if (this != &other) {
+                    assign(other.data(), other.size());
+                }
+                return *this;
+            }
+
+            body_buffer& operator=(body_buffer&& other) noexcept {
+                if (this != &other) {
+                    release();
+                    take(other);
+                }
+                return *this;
+            }
+
+            ~body_buffer() {
+                release();
+            }
+
+            uint8_t* data() { return heap ? heap : local; }
+            const uint8_t* data() const { return heap ? heap : local; }
+
+            size_t size() const { return length; }
+            size_t capacity() const { return heap ? heapCapacity : InlineCapacity; }
+            bool empty() const { return length == 0; }
+
+            // true while the contents still fit in the inline storage
+            bool is_inline() const { return heap == nullptr; }
+
+            // where heap blocks come from, nullptr for plain new[]
+            std::pmr::memory_resource* resource() const { return memory; }
+
+            uint8_t& operator[](size_t i) { return data()[i]; }
+            const uint8_t& operator[](size_t i) const { return data()[i]; }
+
+            iterator begin() { return data(); }
+            iterator end() { return data() + length; }
+            const_iterator begin() const { return data(); }
+            const_iterator end() const { return data() + length; }
+
+            void reserve(size_t n) {
+                if (n > capacity()) {
+                    grow(n);
+                }
+            }
+
+            // new bytes are zeroed, the same as std::vector<uint8_t>::resize
+            void resize(size_t n) {
+                if (n <= length) {
+                    length = n;
+                    return;
+                }
+
+                // grow geometrically so repeated pushes stay amortised O(1)
+                uint8_t* block = n > capacity() ? grow(std::max(n, capacity() * 2)) : data();
+                std::memset(block + length, 0, n - length);
+                length = n;
+            }
+
+            void clear() {
+                length = 0;
+            }
+
+            // drop any heap storage and go back to the inline buffer
+            void shrink_to_fit() {
+                if (heap && length <= InlineCapacity) {
+                    std::memcpy(local, heap, length);
+                    free_block(heap, heapCapacity);
+                    heap = nullptr;
+                    heapCapacity = 0;
+                }
+            }
+
+        private:
+            void assign(const uint8_t* src, size_t n) {
+                length = 0;
+                uint8_t* block = n > capacity() ? grow(n) : data();
+                if (n > 0) {
+                    std::memcpy(block, src, n);
+                }
+                length = n;
+            }
+
+            // returns the new block, which is now data()
+            uint8_t* grow(size_t n) {
+                uint8_t* bigger = memory ? static_cast<uint8_t*>(memory->allocate(n, alignof(std::max_align_t))) : new uint8_t[n];
+                if (length > 0) {
+                    std::memcpy(bigger, data(), length);
+                }
+                free_block(heap, heapCapacity);
+                heap = bigger;
+                heapCapacity = n;
+                return bigger;
+            }
+
+            void free_block(uint8_t* block, size_t n) {
+                if (block == nullptr) {
+                    return;
+                }
+                if (memory) {
+                    memory->deallocate(block, n, alignof(std::max_align_t));
+                } else {
+                    delete[] block;
+                }
+            }
+
+            // storage (and the resource it came from) moves across with the contents
+            void take(body_buffer& other) {
+                memory = other.memory;
+                if (other.heap) {
+                    heap = other.heap;
+                    heapCapacity = other.heapCapacity;
+                    other.heap = nullptr;
+                    other.heapCapacity = 0;
+                } else if (other.length > 0) {
+                    std::memcpy(local, other.local, other.length);
+                }
+                length = other.length;
+                other.length = 0;
+            }
+
+            void release() {
+                free_block(heap, heapCapacity);
+                heap = nullptr;
+                heapCapacity = 0;
+                length = 0;
+            }
+
+            std::pmr::memory_resource* memory = nullptr;
+            uint8_t* heap = nullptr;
+            size_t heapCapacity = 0;
+            size_t length = 0;
+            // aligned like a heap block so views into the body can be read as typed arrays
+            alignas(16) uint8_t local[InlineCapacity];
+        };
+    }
+}
+
+#endif
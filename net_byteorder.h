@@ -0,0 +1,216 @@
+// Created by psdab on 5/2/2024.
+
+#ifndef BETTER_SERVER_NET_BYTEORDER_H
+#define BETTER_SERVER_NET_BYTEORDER_H
+#pragma once
+
+#include "net_common.h"
+
+#include <bit>
+#include <cstring>
+#include <span>
+
+// the widest shuffle the compiler has been told it can use is always taken. otherwise on x86 the AVX2 and SSSE3
+// loops are still compiled (gcc and clang build them for their own target, msvc allows the intrinsics anywhere)
+// and the first large swap picks one from what the cpu supports, so a build without -mavx2 gets them too.
+// everything else takes the scalar path
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define PS_NET_BYTESWAP_AVX2
+#define PS_NET_BYTESWAP_SSSE3
+#define PS_NET_TARGET_AVX2
+#define PS_NET_TARGET_SSSE3
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define PS_NET_BYTESWAP_AVX2
+#define PS_NET_BYTESWAP_SSSE3
+#define PS_NET_BYTESWAP_RUNTIME
+#define PS_NET_TARGET_AVX2 __attribute__((target("avx2")))
+#define PS_NET_TARGET_SSSE3 __attribute__((target("ssse3")))
+#elif defined(_MSC_VER) && defined(_M_X64)
+#include <immintrin.h>
+#include <intrin.h>
+#define PS_NET_BYTESWAP_AVX2
+#define PS_NET_BYTESWAP_SSSE3
+#define PS_NET_BYTESWAP_RUNTIME
+#define PS_NET_TARGET_AVX2
+#define PS_NET_TARGET_SSSE3
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#define PS_NET_BYTESWAP_SSSE3
+#define PS_NET_TARGET_SSSE3
+#endif
+
+namespace ps {
+    namespace net {
+        // wraps an array so it is pushed/pulled in network (big endian) byte order instead of
+        // the host's own, e.g. msg << network_order(std::span<const float>(positions));
+        template <typename Range>
+        struct network_order_t {
+            Range& items;
+        };
+
+        template <typename Range>
+        network_order_t<Range> network_order(Range& items) {
+            return {items};
+        }
+
+        template <typename Range>
+        network_order_t<const Range> network_order(const Range& items) {
+            return {items};
+        }
+
+        namespace detail {
+            // written with shifts the compilers turn into a single bswap/rev instruction
+            inline uint16_t byteswap_value(uint16_t v) {
+                return uint16_t((v >> 8) | (v << 8));
+            }
+
+            inline uint32_t byteswap_value(uint32_t v) {
+                return (v >> 24) | ((v >> 8) & 0x0000ff00u) | ((v << 8) & 0x00ff0000u) | (v << 24);
+            }
+
+            inline uint64_t byteswap_value(uint64_t v) {
+                return (uint64_t(byteswap_value(uint32_t(v))) << 32) | byteswap_value(uint32_t(v >> 32));
+            }
+
+            template <size_t Width>
+            using byteswap_word = std::conditional_t<Width == 2, uint16_t, std::conditional_t<Width == 4, uint32_t, uint64_t>>;
+
+            template <size_t Width>
+            void byteswap_scalar(uint8_t* dst, const uint8_t* src, size_t count) {
+                for (size_t i = 0; i < count; i++) {
+                    // a whole word at a time, read before it is written so swapping in place works too
+                    byteswap_word<Width> item;
+                    std::memcpy(&item, src + i * Width, Width);
+                    item = byteswap_value(item);
+                    std::memcpy(dst + i * Width, &item, Width);
+                }
+            }
+
+#if defined(PS_NET_BYTESWAP_SSSE3)
+            // shuffle mask that reverses every Width byte group in a 16 byte lane
+            template <size_t Width>
+            PS_NET_TARGET_SSSE3 __m128i byteswap_mask() {
+                alignas(16) uint8_t mask[16];
+                for (size_t i = 0; i < 16; i++) {
+                    mask[i] = uint8_t((i / Width) * Width + (Width - 1 - i % Width));
+                }
+                return _mm_load_si128(reinterpret_cast<const __m128i*>(mask));
+            }
+
+            // each of these swaps as many whole vectors as there are and returns the bytes it did
+            template <size_t Width>
+            PS_NET_TARGET_SSSE3 size_t byteswap_ssse3(uint8_t* dst, const uint8_t* src, size_t bytes) {
+                const __m128i mask = byteswap_mask<Width>();
+                size_t done = 0;
+                for (; done + 16 <= bytes; done += 16) {
+                    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + done));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + done), _mm_shuffle_epi8(v, mask));
+                }
+                return done;
+            }
+#endif
+
+#if defined(PS_NET_BYTESWAP_AVX2)
+            template <size_t Width>
+            PS_NET_TARGET_AVX2 size_t byteswap_avx2(uint8_t* dst, const uint8_t* src, size_t bytes) {
+                const __m128i lane = byteswap_mask<Width>();
+                const __m256i mask = _mm256_broadcastsi128_si256(lane);
+                size_t done = 0;
+                for (; done + 32 <= bytes; done += 32) {
+                    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + done));
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + done), _mm256_shuffle_epi8(v, mask));
+                }
+                for (; done + 16 <= bytes; done += 16) {
+                    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + done));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + done), _mm_shuffle_epi8(v, lane));
+                }
+                return done;
+            }
+#endif
+
+#if defined(PS_NET_BYTESWAP_RUNTIME)
+            enum class byteswap_isa : uint8_t {
+                scalar,
+                ssse3,
+                avx2
+            };
+
+            inline byteswap_isa detect_byteswap_isa() {
+#if defined(_MSC_VER) && !defined(__clang__)
+                int info[4];
+                __cpuid(info, 0);
+                int highest = info[0];
+                __cpuid(info, 1);
+                bool ssse3 = info[2] & (1 << 9);
+                // AVX2 also needs the os to save the ymm registers (osxsave, then xcr0 bits 1 and 2)
+                bool ymm = (info[2] & (1 << 27)) && (_xgetbv(0) & 0x6) == 0x6;
+                bool avx2 = false;
+                if (highest >= 7 && ymm) {
+                    __cpuidex(info, 7, 0);
+                    avx2 = info[1] & (1 << 5);
+                }
+#else
+                __builtin_cpu_init();
+                bool ssse3 = __builtin_cpu_supports("ssse3");
+                bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+                return avx2 ? byteswap_isa::avx2 : ssse3 ? byteswap_isa::ssse3 : byteswap_isa::scalar;
+            }
+
+            // looked up once, the first time it is needed
+            inline byteswap_isa byteswap_support() {
+                static const byteswap_isa isa = detect_byteswap_isa();
+                return isa;
+            }
+#endif
+
+            template <size_t Width>
+            void byteswap_block(uint8_t* dst, const uint8_t* src, size_t count) {
+                size_t bytes = count * Width;
+                size_t done = 0;
+
+#if defined(PS_NET_BYTESWAP_RUNTIME)
+                // too short for a vector register, so there is nothing to pick
+                if (bytes >= 16) {
+                    switch (byteswap_support()) {
+                        case byteswap_isa::avx2:
+                            done = byteswap_avx2<Width>(dst, src, bytes);
+                            break;
+                        case byteswap_isa::ssse3:
+                            done = byteswap_ssse3<Width>(dst, src, bytes);
+                            break;
+                        case byteswap_isa::scalar:
+                            break;
+                    }
+                }
+#elif defined(PS_NET_BYTESWAP_AVX2)
+                done = byteswap_avx2<Width>(dst, src, bytes);
+#elif defined(PS_NET_BYTESWAP_SSSE3)
+                done = byteswap_ssse3<Width>(dst, src, bytes);
+#endif
+
+                // whatever didn't fill a whole vector register
+                byteswap_scalar<Width>(dst + done, src + done, (bytes - done) / Width);
+            }
+        }
+
+        // copy count elements of Width bytes from src to dst, converting between host and network byte order.
+        // src and dst may be the same buffer
+        template <size_t Width>
+        void copy_network_order(uint8_t* dst, const uint8_t* src, size_t count) {
+            static_assert(Width == 1 || Width == 2 || Width == 4 || Width == 8, "only 1, 2, 4 and 8 byte elements have a network byte order");
+
+            if constexpr (std::endian::native == std::endian::big || Width == 1) {
+                if (dst != src) {
+                    std::memmove(dst, src, count * Width);
+                }
+            } else {
+                detail::byteswap_block<Width>(dst, src, count);
+            }
+        }
+    }
+}
+
+#endif
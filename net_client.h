@@ -6,6 +6,7 @@
 
 #include "net_common.h"
 #include "net_tsqueue.h"
+#include "net_mpsc_queue.h"
 #include "net_message.h"
 #include "net_connection.h"
 
@@ -31,7 +32,8 @@ namespace ps {
                     asio::ip::tcp::resolver::results_type endpoints = resolver.resolve(host, std::to_string(port));
 
                     // create connection
-                    m_connection = std::make_unique<connection<T>>(connection<T>::owner::client, context, asio::ip::tcp::socket(context), messages_in);
+                    m_connection = std::make_unique<connection<T>>(connection<T>::owner::client, context, asio::ip::tcp::socket(context), messages_in, options);
+                    m_connection->SetChunkSink(chunkSink);
 
                     // tell the connection object to connect to server
                     m_connection->ConnectToServer(endpoints);
@@ -66,15 +68,92 @@ namespace ps {
                 }
             }
 
-            // send message to the server
-            void Send(const message<T>& msg)
+            // send message to the server on one of the outbound lanes, returns true if it was queued
+            bool Send(const message<T>& msg, size_t lane = 0)
             {
                 if (IsConnected()) {
-                    m_connection->Send(msg);
+                    return m_connection->Send(msg, lane);
                 }
+                return false;
             }
 
-            tsqueue<owned_message<T>>& Incoming() {
+            bool Send(shared_message<T> msg, size_t lane = 0)
+            {
+                if (IsConnected()) {
+                    return m_connection->Send(std::move(msg), lane);
+                }
+                return false;
+            }
+
+            // send a large body as a stream of chunks the server handles as they arrive (OnStreamChunk), on the
+            // last bulk lane unless told otherwise. returns the stream id or 0 if it was refused. chunks from the
+            // server arrive in Incoming as connection_event::chunk (see read_chunk), or go to the chunk sink if there is one
+            uint32_t SendChunked(const message<T>& msg, size_t lane = connection<T>::stream_lane, size_t chunkSize = 16 * 1024)
+            {
+                if (IsConnected()) {
+                    return m_connection->SendChunked(msg, lane, chunkSize);
+                }
+                return 0;
+            }
+
+            // the same without copying the body, it is shared until the last chunk has been written
+            uint32_t SendChunked(shared_message<T> msg, size_t lane = connection<T>::stream_lane, size_t chunkSize = 16 * 1024)
+            {
+                if (IsConnected()) {
+                    return m_connection->SendChunked(std::move(msg), lane, chunkSize);
+                }
+                return 0;
+            }
+
+            // ask for the compact header format, it is used if the server offers it. call before Connect
+            void SetWireFormat(wire_format format) {
+                options.format = format;
+            }
+
+            // limits on how many queued frames go out in one gathered write. call before Connect
+            void SetWriteBatch(size_t maxBytes, size_t maxBuffers) {
+                options.write_batch_bytes = maxBytes;
+                options.write_batch_buffers = maxBuffers;
+            }
+
+            // size of each connection's receive buffer, every complete frame in it is parsed per read. call before Connect
+            void SetReadBuffer(size_t bytes) {
+                options.read_buffer_size = bytes;
+            }
+
+            // high and low water marks for the outbound queue, messages sent past them are refused
+            // (or the oldest dropped, or the connection closed, depending on the policy). call before Connect
+            void SetOutboundLimits(size_t highBytes, size_t lowBytes, size_t highMessages, size_t lowMessages) {
+                options.outbound_high_bytes = highBytes;
+                options.outbound_low_bytes = lowBytes;
+                options.outbound_high_messages = highMessages;
+                options.outbound_low_messages = lowMessages;
+            }
+
+            void SetSlowConsumerPolicy(slow_consumer_policy policy) {
+                options.slow_consumer = policy;
+            }
+
+            // close the connection if the server sends a frame with a bigger body than this, zero for no limit.
+            // call before Connect
+            void SetMaxFrameSize(size_t bytes) {
+                options.max_frame_size = bytes;
+            }
+
+            // the outbound lanes after the control lane (lane 0), one weight per bulk lane. call before Connect
+            void SetOutboundLanes(std::vector<uint32_t> bulkWeights, size_t quantum = 16 * 1024) {
+                options.bulk_lanes = std::move(bulkWeights);
+                options.lane_quantum = std::max<size_t>(quantum, 1);
+            }
+
+            // handle each chunk from the server as it arrives instead of finding it in Incoming, the client's
+            // counterpart of the server's OnStreamChunk. there is no Update on this side, so the sink runs on the
+            // io thread and must not block, and chunk.data is only valid during the call. call before Connect
+            void SetChunkSink(std::function<void(T id, const stream_chunk& chunk)> sink) {
+                chunkSink = std::move(sink);
+            }
+
+            mpsc_queue<owned_message<T>>& Incoming() {
                 return messages_in;
             }
         protected:
@@ -84,9 +163,13 @@ namespace ps {
             std::thread context_thread;
             // the client has a single instance of a "connection" object which handles data transfer
             std::unique_ptr<connection<T>> m_connection;
+            // settings for the connection
+            connection_options options;
+            // where chunks from the server go, Incoming if empty
+            std::function<void(T id, const stream_chunk& chunk)> chunkSink;
         private:
-            // tsq for incoming messages
-            tsqueue<owned_message<T>> messages_in;
+            // lock-free queue for incoming messages, filled by the io thread
+            mpsc_queue<owned_message<T>> messages_in;
         };
     }
 }
@@ -15,6 +15,7 @@
 #include <chrono>
 #include <cstdint>
 #include <type_traits>
+#include <atomic>
 
 #ifdef _WIN32 // specifies which version of windows to use, because apparently every version of windows handles networking slightly differently
 #define _WIN32_WINNT 0x0A00
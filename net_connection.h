@@ -6,28 +6,122 @@
 
 #include "net_common.h"
 #include "net_tsqueue.h"
+#include "net_mpsc_queue.h"
+#include "net_timer_wheel.h"
+#include "net_io_pool.h"
+#include "net_dispatch.h"
+#include "net_threading.h"
+#include "net_rate_limit.h"
 #include "net_message.h"
+#include "net_stream.h"
+
+#include <cmath>
 
 namespace ps {
     namespace net {
         // forward declaration
-        template <typename T>
+        template <typename T, typename Threading = queued_dispatch>
         class server_interface;
 
-        template <typename T>
-        class connection : public std::enable_shared_from_this<connection<T>> {
+        // what Send does with a message for a connection whose outbound queue is over its high water mark
+        enum class slow_consumer_policy : uint8_t {
+            drop_new,     // refuse the new message
+            drop_oldest,  // queue it and throw away the oldest messages that aren't being written yet
+            disconnect,   // refuse it and close the connection
+            notify        // ask the server's OnClientBackpressure whether to queue it anyway
+        };
+
+        // settings a server or client hands to each of its connections
+        struct connection_options {
+            // header format to ask for during the handshake
+            wire_format format = wire_format::classic;
+
+            // queued frames are written out together with one gathered write (writev),
+            // as many as fit in this many bytes and this many buffers (each frame uses one for its
+            // header and one for its body). the first frame always goes, however big it is
+            size_t write_batch_bytes = 64 * 1024;
+            size_t write_batch_buffers = 64;
+
+            // incoming bytes are read in chunks of up to this size and every complete frame in a chunk
+            // is parsed in one pass. frames bigger than this are read straight into their message
+            size_t read_buffer_size = 8 * 1024;
+
+            // where received bodies too big to be stored inline get their memory from, nullptr for the heap
+            std::pmr::memory_resource* body_pool = nullptr;
+
+            // limits on what may wait in the outbound queue. once either high mark is reached the connection
+            // counts as congested, and it stays that way until both counts are back under the low marks
+            size_t outbound_high_bytes = 8 * 1024 * 1024;
+            size_t outbound_low_bytes = 4 * 1024 * 1024;
+            size_t outbound_high_messages = 64 * 1024;
+            size_t outbound_low_messages = 32 * 1024;
+            slow_consumer_policy slow_consumer = slow_consumer_policy::drop_new;
+
+            // deadlines kept on the io context's timing wheel, zero turns one off. a client must finish the
+            // handshake within handshake_timeout, and a validated one is closed after idle_timeout without
+            // receiving anything. a heartbeat is sent when nothing else has been written for heartbeat_interval
+            std::chrono::milliseconds handshake_timeout{10000};
+            std::chrono::milliseconds idle_timeout{0};
+            std::chrono::milliseconds heartbeat_interval{0};
+
+            // a server side connection keeps what it has received in its own short queue until Update takes it.
+            // once this many are waiting it stops reading from the socket, and starts again at half. the check is made
+            // once per read, so the queue can go over by what one read delivered (never more than this many again)
+            size_t inbound_queue_length = 1024;
+
+            // how fast a server side connection lets its client send, checked before a frame is copied anywhere
+            rate_limit inbound_limit;
+
+            // a frame with a bigger body closes the connection before anything is allocated for it, zero for no limit.
+            // payloads bigger than this can still be sent as streams of smaller chunks
+            size_t max_frame_size = 0;
+
+            // a server side connection's share of its io thread's egress limit, relative to the other connections on it
+            double egress_weight = 1.0;
+
+            // outbound priority lanes, picked per Send. lane 0 (the default) is for control traffic and always
+            // goes first, then each bulk lane listed here takes turns earning lane_quantum * its weight in bytes.
+            // with none listed there is still one bulk lane, which is where streams go by default
+            std::vector<uint32_t> bulk_lanes;
+            size_t lane_quantum = 16 * 1024;
+        };
+
+        // Threading is the owning server's threading policy, a client's connection always queues
+        template <typename T, typename Threading>
+        class connection : public std::enable_shared_from_this<connection<T, Threading>> {
         public:
             enum class owner {
                 server,
                 client
             };
 
-            connection(owner parent, asio::io_context& context, asio::ip::tcp::socket socket, tsqueue<owned_message<T>>& in) :
-            context(context), socket(std::move(socket)), messages_in(in) {
+            // where received messages and lifecycle events go, nowhere with inline handlers
+            using incoming_queue = std::conditional_t<Threading::inline_handlers, compiled_out, mpsc_queue<owned_message<T, Threading>>>;
+
+            connection(owner parent, asio::io_context& context, asio::ip::tcp::socket socket, incoming_queue& in,
+                       const connection_options& options = {}) :
+            socket(std::move(socket)), context(context), messages_in(in), options(options), PreferredFormat(options.format) {
                 OwnerType = parent;
 
+                // each frame in a batch needs its own encoded header
+                WriteHeaders.resize(std::max<size_t>(this->options.write_batch_buffers / 2, 1));
+                lanes = std::vector<outbound_lane>(1 + std::max<size_t>(this->options.bulk_lanes.size(), 1));
+                for (size_t i = 0; i < this->options.bulk_lanes.size(); i++) {
+                    lanes[i + 1].weight = std::max<uint32_t>(this->options.bulk_lanes[i], 1);
+                }
+                // a stream's chunk takes three buffers: header, prefix and data
+                WriteBuffers.reserve(std::max<size_t>(this->options.write_batch_buffers, 3));
+                // always big enough to hold any header, so a partial one can wait for the next read
+                ReceiveBuffer.resize(std::max(this->options.read_buffer_size, 2 * max_header_size<T>));
+                tempMessageIn.body = typename message<T>::body_type(this->options.body_pool);
+                ApplyRateLimit(this->options.inbound_limit);
+                EgressWeight.store(std::max(this->options.egress_weight, 0.01), std::memory_order_relaxed);
+                EgressWindowStart = std::chrono::steady_clock::now();
+
                 if (OwnerType == owner::server) {
-                    HandshakeOut = uint64_t(std::chrono::system_clock::now().time_since_epoch().count());
+                    // the top byte of the handshake advertises which wire formats this server accepts
+                    HandshakeOut = uint64_t(std::chrono::system_clock::now().time_since_epoch().count()) & HandshakeValueMask;
+                    HandshakeOut |= uint64_t(HandshakeOfferTag | (PreferredFormat == wire_format::compact ? HandshakeOfferCompact : 0)) << 56;
                     HandshakeCheck = scramble(HandshakeOut);
                 } else {
                     HandshakeIn = 0;
@@ -36,33 +130,207 @@ namespace ps {
             };
 
             virtual ~connection() {
-
+                if (shard) {
+                    shard->connections.fetch_sub(1, std::memory_order_relaxed);
+                }
             };
 
+            // the id the server's registry gave this client when it validated, 0 until then
             uint32_t GetID() const {
+                return id.load(std::memory_order_relaxed);
+            }
+
+            // the header format agreed with the remote during the handshake
+            wire_format GetWireFormat() const {
+                return Format;
+            }
+
+            // how many frames each read from the socket has delivered on average
+            double FramesPerRead() const {
+                uint64_t reads = ReadCalls.load(std::memory_order_relaxed);
+                return reads ? double(FramesRead.load(std::memory_order_relaxed)) / double(reads) : 0.0;
+            }
+
+            // how many frames each gathered write has carried on average
+            double FramesPerWrite() const {
+                uint64_t writes = WriteCalls.load(std::memory_order_relaxed);
+                return writes ? double(FramesWritten.load(std::memory_order_relaxed)) / double(writes) : 0.0;
+            }
+
+            // bytes and messages waiting in the outbound queue, including the batch being written
+            size_t QueuedBytes() const {
+                return OutboundBytes.load(std::memory_order_relaxed);
+            }
+
+            size_t QueuedMessages() const {
+                return OutboundMessages.load(std::memory_order_relaxed);
+            }
+
+            // the same for one outbound lane
+            size_t QueuedBytes(size_t lane) const {
+                return lanes[std::min(lane, lanes.size() - 1)].bytes.load(std::memory_order_relaxed);
+            }
+
+            size_t QueuedMessages(size_t lane) const {
+                return lanes[std::min(lane, lanes.size() - 1)].messages.load(std::memory_order_relaxed);
+            }
+
+            // the control lane plus the bulk lanes (at least one)
+            size_t LaneCount() const {
+                return lanes.size();
+            }
+
+            // true between reaching a high water mark and draining back under the low ones
+            bool IsCongested() const {
+                return Congested.load(std::memory_order_relaxed);
+            }
+
+            // messages refused or thrown away by the slow consumer policy
+            uint64_t DroppedMessages() const {
+                return Dropped.load(std::memory_order_relaxed);
+            }
+
+            // received frames that were over the rate limit, whatever was done with them
+            uint64_t RateLimitedFrames() const {
+                return RateLimited.load(std::memory_order_relaxed);
+            }
+
+            // any thread - replace this connection's rate limit, e.g. from OnClientValidated.
+            // the buckets start out full
+            void SetRateLimit(const rate_limit& limit) {
+                asio::post(context, [this, self = Self(), limit]() {
+                    ApplyRateLimit(limit);
+                });
+            }
+
+            // bytes written to the socket so far
+            uint64_t BytesWritten() const {
+                return BytesSent.load(std::memory_order_relaxed);
+            }
+
+            // bytes/sec written over the last second or so that anything was written, and the share of the
+            // io thread's egress limit this connection is entitled to while it keeps busy (zero without a limit)
+            double EgressRate() const {
+                return EgressAchieved.load(std::memory_order_relaxed);
+            }
+
+            double EgressTarget() const {
+                double joined = EgressJoined.load(std::memory_order_relaxed);
+                return shard ? shard->egress.Share(joined > 0 ? joined : EgressWeight.load(std::memory_order_relaxed), joined > 0) : 0.0;
+            }
+
+            // any thread - this connection's share of its io thread's egress limit relative to the others
+            // on it, e.g. from OnClientValidated. takes effect from its next turn
+            void SetEgressWeight(double weight) {
+                EgressWeight.store(std::max(weight, 0.01), std::memory_order_relaxed);
+            }
+
+            // what a client answers the server's handshake value with, having picked format from what the server
+            // offered. for load generators and the like that talk to a server without a connection of their own
+            static uint64_t HandshakeAnswer(uint64_t challenge, wire_format format = wire_format::classic) {
+                return scramble(challenge) | (uint64_t(format) << 56);
+            }
+
+            // any thread - an id for a new stream on this connection, never 0
+            uint32_t OpenStream() {
+                return NextStream.fetch_add(1, std::memory_order_relaxed) + 1;
+            }
+
+            // client side - where chunks go instead of the incoming queue, called on the io thread
+            // as each one arrives. set before connecting
+            void SetChunkSink(std::function<void(T id, const stream_chunk& chunk)> sink) {
+                ChunkSink = std::move(sink);
+            }
+
+            // the lane streams go on unless told otherwise, the last bulk lane, so control traffic never waits behind one
+            static constexpr size_t stream_lane = std::numeric_limits<size_t>::max();
+
+            // send one piece of a stream on a lane, last marks the end of it. the remote gets every chunk
+            // as it arrives (a server through OnStreamChunk, a client through its chunk sink or as a chunk event), so neither side
+            // holds the whole payload. a refused chunk leaves the stream incomplete, end it with AbortStream
+            bool SendChunk(T id, uint32_t stream, std::span<const uint8_t> data, bool last, size_t lane = stream_lane) {
+                return Send(make_shared_message(make_chunk(id, stream, data, last)), lane);
+            }
+
+            // tell the remote a stream sent with SendChunk won't be finished, it gets an empty last chunk marked aborted.
+            // never refused, however congested the connection is
+            void AbortStream(T id, uint32_t stream, size_t lane = stream_lane) {
+                Enqueue(make_shared_message(make_chunk_prefix(id, stream, 0, chunk_aborted)), lane);
+            }
+
+            // send msg's body as a stream of chunkSize chunks, which other messages and lanes interleave with.
+            // the chunks are cut on the io thread as the earlier ones are written, a write batch or so ahead,
+            // and point into the shared body rather than copying it (the const message& form copies it once).
+            // the slow consumer policy is asked once for the whole stream, and if it later drops one of the
+            // chunks the rest of the stream goes too and the remote gets an aborted last chunk.
+            // returns the stream id, or 0 if the stream was refused
+            uint32_t SendChunked(const message<T>& msg, size_t lane = stream_lane, size_t chunkSize = 16 * 1024) {
+                return SendChunked(make_shared_copy(msg), lane, chunkSize);
+            }
+
+            uint32_t SendChunked(shared_message<T> msg, size_t lane = stream_lane, size_t chunkSize = 16 * 1024) {
+                if (!AdmitOutgoing(msg)) {
+                    return 0;
+                }
+
+                auto stream = std::make_shared<outbound_stream>();
+                stream->source = std::move(msg);
+                stream->id = OpenStream();
+                stream->chunkSize = std::clamp<size_t>(chunkSize, 1, chunk_frame_flag - 1 - chunk_prefix_size);
+                stream->lane = std::min(lane, lanes.size() - 1);
+                uint32_t id = stream->id;
+
+                if constexpr (Threading::inline_handlers) {
+                    FeedStream(stream);
+                } else {
+                    asio::post(context, [this, self = Self(), stream = std::move(stream)]() {
+                        FeedStream(stream);
+                    });
+                }
                 return id;
             }
 
-            void ConnectToClient(ps::net::server_interface<T>* server, uint32_t id = 0) {
+            // shard is the io thread this connection was created on (its context and timing wheel),
+            // heartbeat is what gets sent when the connection has been quiet (nothing if it's empty).
+            // can be called from any thread, the handshake itself starts on the connection's own
+            void ConnectToClient(ps::net::server_interface<T, Threading>* server,
+                                 io_shard* shard = nullptr, shared_message<T> heartbeat = nullptr) {
                 if (OwnerType == owner::server) {
                     if (socket.is_open()) {
-                        this->id = id;
+                        this->server = server;
+                        this->shard = shard;
+                        this->timers = shard ? &shard->timers : nullptr;
+                        this->heartbeat = std::move(heartbeat);
+                        if (shard) {
+                            shard->connections.fetch_add(1, std::memory_order_relaxed);
+                        }
 
-                        // client has attempted to connect to the server,
-                        // but we want the client to validate itself first,
-                        // so we write out the handshake data to be validated
-                        WriteValidation();
+                        asio::post(context, [this, self = Self()]() {
+                            // the wheel is only touched from the io thread
+                            if (timers && options.handshake_timeout.count() > 0) {
+                                After(options.handshake_timeout, [this]() {
+                                    if (!Validated) {
+                                        TimedOut("handshake timeout");
+                                    }
+                                });
+                            }
 
-                        // create a task that sits and waits for asynchronously
-                        // for the client to respond to the validation request
-                        ReadValidation(server);
+                            // client has attempted to connect to the server,
+                            // but we want the client to validate itself first,
+                            // so we write out the handshake data to be validated
+                            WriteValidation();
+
+                            // create a task that sits and waits for asynchronously
+                            // for the client to respond to the validation request
+                            ReadValidation();
+                        });
                     }
                 }
             }
 
             void ConnectToServer(const asio::ip::tcp::resolver::results_type& endpoints) {
                 if (OwnerType == owner::client) {
-                    asio::async_connect(socket, endpoints, [this](std::error_code ec, asio::ip::tcp::endpoint endpoint) {
+                    asio::async_connect(socket, endpoints, [this](std::error_code ec, asio::ip::tcp::endpoint) {
                         if (!ec) {
                             ReadValidation();
                         }
@@ -70,139 +338,903 @@ namespace ps {
                 }
             };
 
+            // returns false if the connection was already closed
             bool Disconnect() {
                 if (IsConnected()) {
-                    asio::post(context, [this]() { socket.close(); });
+                    asio::post(context, [this, self = Self()]() { Close(); });
+                    return true;
                 }
+                return false;
             };
 
             bool IsConnected() const {
                 return socket.is_open();
             };
 
-            void Send(const message<T>& msg) {
-                asio::post(context, [this, msg]() {
-                    bool WritingMessage = !messages_out.empty();
-                    messages_out.push_back(msg);
-                    if (!WritingMessage) {
-                        WriteHeader();
-                    }
-                });
+            bool Send(const message<T>& msg, size_t lane = 0) {
+                return Send(make_shared_copy(msg), lane);
+            };
+
+            // the message is shared rather than copied, so the same payload can be
+            // handed to any number of connections. returns false if the slow consumer policy refused it.
+            // with the notify policy OnClientBackpressure runs on the calling thread.
+            // with inline handlers the caller is the io thread, so the message is written without a post.
+            // lane picks the outbound priority lane, anything past the last lane goes on the last one.
+            // a body of 2 GiB or more is refused too, its size would run into chunk_frame_flag, so send it with SendChunked
+            bool Send(shared_message<T> msg, size_t lane = 0) {
+                if (msg->body.size() >= chunk_frame_flag || !AdmitOutgoing(msg)) {
+                    return false;
+                }
+                Enqueue(std::move(msg), lane);
+                return true;
             };
+
+        protected:
+            // a stream being sent by SendChunked and one frame waiting in an outbound lane, see below
+            struct outbound_stream;
+            struct outbound_frame;
+
         private:
-            // ASYNC - prime context to read a message header
-            void ReadHeader() {
-                asio::async_read(socket, asio::buffer(&tempMessageIn.header, sizeof(message_header<T>)), [this](std::error_code ec, std::size_t length) {
-                    if (!ec) {
-                        if (tempMessageIn.header.size > 0) {
-                            tempMessageIn.body.resize(tempMessageIn.header.size);
-                            ReadBody();
-                        } else {
-                            AddToIncomingMessageQueue();
+            // handlers hold on to this so a server side connection lives until its pending operations have
+            // completed, even after the server has dropped it. a client's connection isn't shared, so it gets nullptr
+            std::shared_ptr<connection<T, Threading>> Self() {
+                return this->weak_from_this().lock();
+            }
+
+            // whether the slow consumer policy lets msg be queued
+            bool AdmitOutgoing(const shared_message<T>& msg) {
+                if (CheckCongested()) {
+                    switch (options.slow_consumer) {
+                        case slow_consumer_policy::drop_new:
+                            Dropped.fetch_add(1, std::memory_order_relaxed);
+                            return false;
+                        case slow_consumer_policy::disconnect:
+                            Dropped.fetch_add(1, std::memory_order_relaxed);
+                            Disconnect();
+                            return false;
+                        case slow_consumer_policy::notify:
+                            // a client's connection has no server to ask, so it behaves like drop_new
+                            if (server == nullptr || !server->OnClientBackpressure(this->shared_from_this(), msg)) {
+                                Dropped.fetch_add(1, std::memory_order_relaxed);
+                                return false;
+                            }
+                            break;
+                        case slow_consumer_policy::drop_oldest:
+                            // room is made on the io thread, which owns the queue
+                            break;
+                    }
+                }
+                return true;
+            }
+
+            // the second half of Send, queue msg on a lane without asking the slow consumer policy
+            void Enqueue(shared_message<T> msg, size_t lane) {
+                lane = CountOutgoing(*msg, lane);
+                if constexpr (Threading::inline_handlers) {
+                    QueueOutgoing(std::move(msg), lane);
+                } else {
+                    asio::post(context, [this, self = Self(), msg = std::move(msg), lane]() mutable {
+                        QueueOutgoing(std::move(msg), lane);
+                    });
+                }
+            }
+
+            // counted on the sending thread rather than on the io thread so the next Send already sees it.
+            // returns the lane msg goes on
+            size_t CountOutgoing(const message<T>& msg, size_t lane) {
+                lane = std::min(lane, lanes.size() - 1);
+                OutboundBytes.fetch_add(QueuedSize(msg), std::memory_order_relaxed);
+                OutboundMessages.fetch_add(1, std::memory_order_relaxed);
+                lanes[lane].bytes.fetch_add(QueuedSize(msg), std::memory_order_relaxed);
+                lanes[lane].messages.fetch_add(1, std::memory_order_relaxed);
+                return lane;
+            }
+
+            // io thread - the second half of Enqueue, and of the server's broadcasts
+            void QueueOutgoing(shared_message<T> msg, size_t lane) {
+                lanes[lane].queue.push_back({std::move(msg), nullptr, {}});
+                Pending++;
+                if (options.slow_consumer == slow_consumer_policy::drop_oldest) {
+                    DropOldest(lane);
+                }
+                // nothing goes out until the handshake has settled the wire format,
+                // anything queued before then is flushed by StartWriting
+                if (!Writing && Validated) {
+                    Flush();
+                }
+            }
+
+            // what a queued message counts for against the byte limits
+            static size_t QueuedSize(const message<T>& msg) {
+                return max_header_size<T> + msg.body.size();
+            }
+
+            static size_t QueuedSize(const outbound_frame& frame) {
+                return QueuedSize(*frame.msg) + frame.tail.size();
+            }
+
+            // io thread - queue a stream's next chunks until it has a write batch (or one chunk) queued or being
+            // written. each chunk is its prefix plus a view of the stream's payload, which the frame keeps alive
+            void FeedStream(const std::shared_ptr<outbound_stream>& stream) {
+                const auto& body = stream->source->body;
+                size_t ahead = std::max(options.write_batch_bytes, stream->chunkSize);
+                while (!stream->done && stream->queued < ahead) {
+                    size_t length = 0;
+                    uint8_t flag = chunk_aborted;
+                    if (!stream->aborted) {
+                        length = std::min(stream->chunkSize, body.size() - stream->offset);
+                        flag = stream->offset + length == body.size() ? chunk_last : chunk_more;
+                    }
+
+                    outbound_frame frame{make_shared_message(make_chunk_prefix(stream->source->header.id, stream->id, length, flag)),
+                                         stream, std::span<const uint8_t>(body.data() + stream->offset, length)};
+                    size_t bytes = QueuedSize(frame);
+                    stream->offset += length;
+                    stream->queued += bytes;
+                    stream->done = flag != chunk_more;
+
+                    OutboundBytes.fetch_add(bytes, std::memory_order_relaxed);
+                    OutboundMessages.fetch_add(1, std::memory_order_relaxed);
+                    lanes[stream->lane].bytes.fetch_add(bytes, std::memory_order_relaxed);
+                    lanes[stream->lane].messages.fetch_add(1, std::memory_order_relaxed);
+                    lanes[stream->lane].queue.push_back(std::move(frame));
+                    Pending++;
+                }
+
+                if (!Writing && Validated && Pending > 0) {
+                    Flush();
+                }
+            }
+
+            // io thread - a stream lost a chunk, so the rest of it is thrown away and the remote is told it was abandoned
+            void AbandonStream(const std::shared_ptr<outbound_stream>& stream) {
+                auto& queue = lanes[stream->lane].queue;
+                for (auto it = queue.begin(); it != queue.end();) {
+                    if (it->stream == stream) {
+                        Dequeued(stream->lane, QueuedSize(*it));
+                        stream->queued -= QueuedSize(*it);
+                        it = queue.erase(it);
+                        Pending--;
+                        Dropped.fetch_add(1, std::memory_order_relaxed);
+                    } else {
+                        ++it;
+                    }
+                }
+
+                stream->aborted = true;
+                stream->done = false;
+                FeedStream(stream);
+            }
+
+            bool OverHighWater() const {
+                return OutboundBytes.load(std::memory_order_relaxed) >= options.outbound_high_bytes ||
+                       OutboundMessages.load(std::memory_order_relaxed) >= options.outbound_high_messages;
+            }
+
+            bool UnderLowWater() const {
+                return OutboundBytes.load(std::memory_order_relaxed) <= options.outbound_low_bytes &&
+                       OutboundMessages.load(std::memory_order_relaxed) <= options.outbound_low_messages;
+            }
+
+            // senders set the flag, and it is cleared by whichever of a sender or a completed write first sees the
+            // queue back under the low marks. a sender that sets it looks at the counts again afterwards (the fences
+            // pair with the one in Relieved), so a write completing between its check and its store can't leave
+            // the connection marked congested with nothing left to drain
+            bool CheckCongested() {
+                if (Congested.load(std::memory_order_relaxed)) {
+                    if (UnderLowWater()) {
+                        Congested.store(false, std::memory_order_relaxed);
+                        return false;
+                    }
+                    return true;
+                }
+
+                if (OverHighWater()) {
+                    Congested.store(true, std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    if (UnderLowWater()) {
+                        Congested.store(false, std::memory_order_relaxed);
+                        return false;
+                    }
+                    return true;
+                }
+                return false;
+            }
+
+            // io thread - messages have left the queue, so it may be back under the low marks
+            void Relieved() {
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (Congested.load(std::memory_order_relaxed) && UnderLowWater()) {
+                    Congested.store(false, std::memory_order_relaxed);
+                }
+            }
+
+            void Dequeued(size_t lane, size_t bytes) {
+                OutboundBytes.fetch_sub(bytes, std::memory_order_relaxed);
+                OutboundMessages.fetch_sub(1, std::memory_order_relaxed);
+                lanes[lane].bytes.fetch_sub(bytes, std::memory_order_relaxed);
+                lanes[lane].messages.fetch_sub(1, std::memory_order_relaxed);
+            }
+
+            // io thread - the lane the next frame comes from: the control lane while it has anything, otherwise
+            // the bulk lanes take turns (deficit round robin), each turn adding lane_quantum * weight to what
+            // the lane may send. something must be pending
+            size_t NextLane() {
+                if (!lanes[0].queue.empty()) {
+                    return 0;
+                }
+
+                while (true) {
+                    auto& lane = lanes[BulkTurn];
+                    if (lane.queue.empty()) {
+                        lane.deficit = 0;
+                    } else if (lane.deficit >= QueuedSize(lane.queue.front())) {
+                        return BulkTurn;
+                    } else if (!BulkTopped) {
+                        lane.deficit += options.lane_quantum * lane.weight;
+                        BulkTopped = true;
+                        continue;
+                    }
+                    BulkTurn = BulkTurn + 1 < lanes.size() ? BulkTurn + 1 : 1;
+                    BulkTopped = false;
+                }
+            }
+
+            // io thread - take the front frame off a lane picked by NextLane
+            outbound_frame PopLane(size_t lane) {
+                auto frame = std::move(lanes[lane].queue.front());
+                lanes[lane].queue.pop_front();
+                if (lane > 0) {
+                    lanes[lane].deficit -= QueuedSize(frame);
+                }
+                Pending--;
+                return frame;
+            }
+
+            // io thread - run fn on the wheel after delay, as long as this connection is still around by then
+            template <typename F>
+            void After(std::chrono::milliseconds delay, F fn) {
+                After(timers->Ticks(delay), std::move(fn));
+            }
+
+            template <typename F>
+            void After(uint64_t ticks, F fn) {
+                timers->Schedule(ticks, [weak = this->weak_from_this(), fn = std::move(fn)]() {
+                    if (auto self = weak.lock()) {
+                        if (self->socket.is_open()) {
+                            fn();
                         }
+                    }
+                });
+            }
+
+            // io thread - start the idle and heartbeat checks once the client is validated
+            void StartTimers() {
+                if (!timers) {
+                    return;
+                }
+
+                LastRead = LastWrite = timers->Now();
+                if (options.idle_timeout.count() > 0) {
+                    After(options.idle_timeout, [this]() { CheckIdle(); });
+                }
+                if (options.heartbeat_interval.count() > 0 && heartbeat) {
+                    After(options.heartbeat_interval, [this]() { CheckHeartbeat(); });
+                }
+            }
+
+            // reads only stamp the tick they happened on, the check itself reschedules for whatever is left
+            void CheckIdle() {
+                uint64_t limit = timers->Ticks(options.idle_timeout);
+                uint64_t idle = timers->Now() - LastRead;
+                if (idle >= limit) {
+                    TimedOut("idle timeout");
+                    return;
+                }
+                After(limit - idle, [this]() { CheckIdle(); });
+            }
+
+            void CheckHeartbeat() {
+                uint64_t interval = timers->Ticks(options.heartbeat_interval);
+                uint64_t quiet = timers->Now() - LastWrite;
+                if (quiet >= interval) {
+                    if (OutboundMessages.load(std::memory_order_relaxed) == 0) {
+                        Send(heartbeat);
+                    }
+                    quiet = 0;
+                }
+                After(interval - quiet, [this]() { CheckHeartbeat(); });
+            }
+
+            void TimedOut(const char* reason) {
+                std::cout << "[" << id << "] " << reason << "\n";
+                Close();
+            }
+
+            // io thread - close the socket and let the owner know, every error path ends up here
+            void Close() {
+                socket.close();
+                EgressIdle();
+                NotifyDisconnect();
+            }
+
+            // tell the server that this validated connection is gone, at most once.
+            // a connection that never validated was never handed to the server, so there is nothing to tell
+            void NotifyDisconnect() {
+                if (OwnerType == owner::server && Validated && !DisconnectNotified) {
+                    DisconnectNotified = true;
+                    Report(connection_event::disconnect);
+                }
+            }
+
+            // hand an event (and for a message, tempMessageIn) to the server: through this connection's inbound
+            // queue, or with inline handlers by calling it right here on the io thread.
+            // messages are collected and handed over together by FlushReceived, once per read, so the queue's lock
+            // is taken once for every frame a read delivered. returns false once a read has collected as many as
+            // the inbound queue may hold. lifecycle events go straight in, after anything collected before them
+            bool Report(connection_event event) {
+                bool received = event == connection_event::message || event == connection_event::chunk;
+                if constexpr (Threading::inline_handlers) {
+                    if (received) {
+                        server->Deliver(this->shared_from_this(), tempMessageIn, event);
                     } else {
-                        std::cout << "[" << id << "] read header fail\n";
-                        socket.close();
+                        message<T> empty;
+                        server->Deliver(this->shared_from_this(), empty, event);
+                    }
+                    return true;
+                } else {
+                    if (received) {
+                        Received.push_back({this->shared_from_this(), std::move(tempMessageIn), event});
+                        return Received.size() < options.inbound_queue_length;
+                    }
+                    Received.push_back({this->shared_from_this(), {}, event});
+                    FlushReceived();
+                    return true;
+                }
+            }
+
+            // io thread - move what Report collected into the inbound queue under one lock.
+            // returns false if that filled the queue, reading then waits for the server to resume it
+            bool FlushReceived() {
+                if constexpr (Threading::inline_handlers) {
+                    return true;
+                } else {
+                    if (Received.empty()) {
+                        return true;
+                    }
+
+                    bool received = false;
+                    bool schedule;
+                    bool full;
+                    {
+                        std::scoped_lock lock(Inbound.mux);
+                        for (auto& item : Received) {
+                            received = received || item.event == connection_event::message || item.event == connection_event::chunk;
+                            Inbound.items.push_back(std::move(item));
+                        }
+                        schedule = !Inbound.scheduled;
+                        Inbound.scheduled = true;
+
+                        // decided under the lock, so Update can't drain the queue without seeing it
+                        full = received && Inbound.items.size() >= options.inbound_queue_length;
+                        if (full) {
+                            ReadPaused = true;
+                        }
+                    }
+                    Received.clear();
+
+                    // the server only hears about a connection when its queue stops being empty
+                    if (schedule) {
+                        messages_in.push_back({this->shared_from_this(), {}, connection_event::ready});
+                    }
+                    return !full;
+                }
+            }
+
+            // any thread - pick reading back up after the inbound queue was full, starting with
+            // whatever was already in the receive buffer. if the client is also being throttled,
+            // reading picks up when that ends instead
+            void ResumeReading() {
+                asio::post(context, [this, self = Self()]() {
+                    if (socket.is_open() && !Throttled) {
+                        ParseIncoming();
                     }
                 });
             }
 
-            // ASYNC - prime context to read a message body
-            void ReadBody() {
-                asio::async_read(socket, asio::buffer(tempMessageIn.body.data(), tempMessageIn.body.size()), [this](std::error_code ec, std::size_t length) {
+            // io thread - whether reading is waiting for Update to drain the inbound queue
+            bool InboundFull() {
+                if constexpr (Threading::inline_handlers) {
+                    return false;
+                } else {
+                    std::scoped_lock lock(Inbound.mux);
+                    return ReadPaused;
+                }
+            }
+
+            void ApplyRateLimit(const rate_limit& limit) {
+                MessageTokens.reset(limit.messages_per_sec, limit.burst_messages);
+                ByteTokens.reset(limit.bytes_per_sec, limit.burst_bytes);
+                LimitPolicy = limit.policy;
+                LastRefill = std::chrono::steady_clock::now();
+            }
+
+            // io thread - charge a frame against the rate limit, false if either bucket is short.
+            // only server side connections have a timing wheel to wait on, so only they are limited
+            bool Admit(size_t frameBytes) {
+                if (!timers || (!MessageTokens.enabled() && !ByteTokens.enabled())) {
+                    return true;
+                }
+
+                auto now = std::chrono::steady_clock::now();
+                double elapsed = std::chrono::duration<double>(now - LastRefill).count();
+                LastRefill = now;
+                MessageTokens.refill(elapsed);
+                ByteTokens.refill(elapsed);
+
+                if (!MessageTokens.ready(1) || !ByteTokens.ready(double(frameBytes))) {
+                    RateLimited.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                MessageTokens.take(1);
+                ByteTokens.take(double(frameBytes));
+                return true;
+            }
+
+            // io thread - stop reading until the buckets hold enough for the frame that was turned away.
+            // if the inbound queue filled up in the meantime, Update resumes reading instead
+            void Throttle(size_t frameBytes) {
+                Throttled = true;
+                double wait = std::max(MessageTokens.wait(1), ByteTokens.wait(double(frameBytes)));
+                After(std::chrono::milliseconds(int64_t(std::ceil(wait * 1000.0))), [this]() {
+                    Throttled = false;
+                    if (!InboundFull()) {
+                        ParseIncoming();
+                    }
+                });
+            }
+
+            // io thread - throw away the oldest messages until the queue is back under its high water marks,
+            // starting with the lowest priority lane. frames in the write that is in flight aren't queued any more,
+            // and the newest message (the one just queued on newest) always stays. a stream that loses a chunk is abandoned
+            void DropOldest(size_t newest) {
+                std::vector<std::shared_ptr<outbound_stream>> abandoned;
+                for (size_t lane = lanes.size(); lane-- > 0 && OverHighWater();) {
+                    auto& queue = lanes[lane].queue;
+                    size_t keep = lane == newest ? 1 : 0;
+                    while (OverHighWater() && queue.size() > keep) {
+                        auto& frame = queue.front();
+                        Dequeued(lane, QueuedSize(frame));
+                        if (frame.stream) {
+                            frame.stream->queued -= QueuedSize(frame);
+                            if (std::find(abandoned.begin(), abandoned.end(), frame.stream) == abandoned.end()) {
+                                abandoned.push_back(frame.stream);
+                            }
+                        }
+                        queue.pop_front();
+                        Pending--;
+                        Dropped.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+
+                for (const auto& stream : abandoned) {
+                    AbandonStream(stream);
+                }
+            }
+
+            // ASYNC - prime context to read whatever has arrived, up to the free space in the receive buffer
+            void ReadIncoming() {
+                socket.async_read_some(asio::buffer(ReceiveBuffer.data() + ReceiveEnd, ReceiveBuffer.size() - ReceiveEnd), [this, self = Self()](std::error_code ec, std::size_t length) {
                     if (!ec) {
-                        AddToIncomingMessageQueue();
+                        ReadCalls.fetch_add(1, std::memory_order_relaxed);
+                        StampRead();
+                        ReceiveEnd += length;
+                        ParseIncoming();
                     } else {
-                        std::cout << "[" << id << "] read body fail\n";
-                        socket.close();
+                        std::cout << "[" << id << "] read fail\n";
+                        Close();
                     }
                 });
             }
 
-            // ASYNC - prime context to write a message header
-            void WriteHeader() {
-                asio::async_write(socket, asio::buffer(&messages_out.front().header, sizeof(message_header<T>)), [this](std::error_code ec, std::size_t length) {
-                    if (!ec) {
-                        if (messages_out.front().body.size() > 0) {
-                            WriteBody();
-                        } else {
-                            messages_out.pop_front();
+            // hand every complete frame in the receive buffer to the incoming queue in one pass,
+            // then move a partial trailing frame to the front to be finished by the next read
+            void ParseIncoming() {
+                size_t pos = 0;
+                bool paused = false;
 
-                            if (!messages_out.empty()) {
-                                WriteHeader();
-                            }
+                // the rest of a dropped frame that didn't fit in the buffer is thrown away as it arrives
+                if (SkipRemaining > 0) {
+                    pos = std::min(SkipRemaining, ReceiveEnd);
+                    SkipRemaining -= pos;
+                }
+
+                while (true) {
+                    const uint8_t* frame = ReceiveBuffer.data() + pos;
+                    size_t buffered = ReceiveEnd - pos;
+
+                    size_t headerLength = decode_header(frame, buffered, Format, tempMessageIn.header);
+                    if (headerLength == malformed_header) {
+                        std::cout << "[" << id << "] malformed header\n";
+                        Close();
+                        return;
+                    }
+                    if (headerLength == 0) {
+                        if (buffered >= max_header_size<T>) {
+                            std::cout << "[" << id << "] malformed header\n";
+                            Close();
+                            return;
+                        }
+                        break;
+                    }
+
+                    // a chunk is a frame like any other, once the flag is off its size is the body's
+                    bool chunk = tempMessageIn.header.size & chunk_frame_flag;
+                    tempMessageIn.header.size &= ~chunk_frame_flag;
+                    IncomingEvent = chunk ? connection_event::chunk : connection_event::message;
+
+                    size_t bodySize = tempMessageIn.header.size;
+                    if ((chunk && bodySize < chunk_prefix_size) || (options.max_frame_size > 0 && bodySize > options.max_frame_size)) {
+                        std::cout << "[" << id << "] bad frame size\n";
+                        Close();
+                        return;
+                    }
+                    size_t bodyBuffered = buffered - headerLength;
+                    bool large = headerLength + bodySize > ReceiveBuffer.size();
+                    if (bodyBuffered < bodySize && !large) {
+                        break;
+                    }
+
+                    // a frame that is read on its own takes over the socket, so the frames before it go to the
+                    // server first. if that fills the queue the frame waits, it is parsed again on resuming
+                    if (large && bodyBuffered < bodySize && !FlushReceived()) {
+                        paused = true;
+                        break;
+                    }
+
+                    // the frame is complete, or about to be read straight into its message. either way this is
+                    // where it counts against the rate limit, before anything is allocated or copied for it
+                    if (!Admit(headerLength + bodySize)) {
+                        if (LimitPolicy == rate_limit_policy::disconnect) {
+                            std::cout << "[" << id << "] rate limit exceeded\n";
+                            Close();
+                            return;
+                        }
+                        if (LimitPolicy == rate_limit_policy::throttle) {
+                            Throttle(headerLength + bodySize);
+                            break;
+                        }
+
+                        size_t skipped = std::min(bodySize, bodyBuffered);
+                        pos += headerLength + skipped;
+                        SkipRemaining = bodySize - skipped;
+                        continue;
+                    }
+
+                    if (large && bodyBuffered < bodySize) {
+                        // this frame will never fit in the buffer, so take what has arrived
+                        // and read the rest of the body straight into the message
+                        tempMessageIn.body.resize(bodySize);
+                        std::memcpy(tempMessageIn.body.data(), frame + headerLength, bodyBuffered);
+                        ReceiveEnd = 0;
+                        ReadLargeBody(bodyBuffered);
+                        return;
+                    }
+
+                    tempMessageIn.body.resize(bodySize);
+                    if (bodySize > 0) {
+                        std::memcpy(tempMessageIn.body.data(), frame + headerLength, bodySize);
+                    }
+                    paused = !AddToIncomingMessageQueue();
+
+                    pos += headerLength + bodySize;
+                    if (paused) {
+                        break;
+                    }
+                }
+                paused = !FlushReceived() || paused;
+
+                if (pos > 0) {
+                    std::memmove(ReceiveBuffer.data(), ReceiveBuffer.data() + pos, ReceiveEnd - pos);
+                    ReceiveEnd -= pos;
+                }
+
+                // while the inbound queue is full or the client is throttled nothing is read,
+                // and TCP pushes back on the client
+                if (!paused && !Throttled) {
+                    ReadIncoming();
+                }
+            }
+
+            // ASYNC - prime context to read the remainder of a frame too big for the receive buffer
+            void ReadLargeBody(size_t received) {
+                asio::async_read(socket, asio::buffer(tempMessageIn.body.data() + received, tempMessageIn.body.size() - received), [this, self = Self()](std::error_code ec, std::size_t) {
+                    if (!ec) {
+                        ReadCalls.fetch_add(1, std::memory_order_relaxed);
+                        StampRead();
+                        AddToIncomingMessageQueue();
+                        if (FlushReceived()) {
+                            ReadIncoming();
                         }
                     } else {
-                        std::cout << "[" << id << "] write header fail\n";
-                        socket.close();
+                        std::cout << "[" << id << "] read body fail\n";
+                        Close();
                     }
                 });
             }
 
-            // ASYNC - prime context to write a message body
-            void WriteBody() {
-                asio::async_write(socket, asio::buffer(messages_out.front().body.data(), messages_out.front().body.size()), [this](std::error_code ec, std::size_t length) {
+            // io thread - write what is queued, straight away or once the io thread's egress shaper gives this
+            // connection its turn. Writing stays set while it waits, so nothing else starts a write meanwhile
+            void Flush() {
+                if (!shard || !shard->egress.Enabled()) {
+                    WriteMessages();
+                    return;
+                }
+
+                // what is left of the last turn still covers the next frame, so keep going without waiting for another
+                if (EgressDeficit > 0 && EgressSpend()) {
+                    return;
+                }
+
+                if (EgressJoined.load(std::memory_order_relaxed) == 0) {
+                    double weight = EgressWeight.load(std::memory_order_relaxed);
+                    EgressJoined.store(weight, std::memory_order_relaxed);
+                    shard->egress.Join(weight);
+                }
+                Writing = true;
+                shard->egress.Wait(EgressWeight.load(std::memory_order_relaxed), [this, self = Self()](size_t quantum) {
+                    return EgressTurn(quantum);
+                });
+            }
+
+            // io thread - this connection's turn on the shaper: add the quantum to what it may send and write the
+            // frames at the front of the queue that fit, carrying on after each write while the deficit lasts.
+            // true while the first frame still needs more turns. those turns are charged to the shaper as they
+            // happen, so saving up for a big frame takes as long as sending it would, and the frame isn't charged again
+            bool EgressTurn(size_t quantum) {
+                if (!socket.is_open() || Pending == 0) {
+                    Writing = false;
+                    EgressIdle();
+                    return false;
+                }
+
+                // the limit was lifted while this connection waited
+                if (quantum == std::numeric_limits<size_t>::max()) {
+                    EgressDeficit = 0;
+                    EgressPrepaid = 0;
+                    WriteMessages();
+                    return false;
+                }
+
+                // never save up more than the frame it is waiting for needs, plus a turn
+                size_t front = QueuedSize(lanes[NextLane()].queue.front());
+                EgressDeficit = std::min(EgressDeficit + quantum, front + quantum);
+                if (EgressSpend()) {
+                    return false;
+                }
+
+                EgressPrepaid += quantum;
+                shard->egress.Charge(quantum);
+                return true;
+            }
+
+            // io thread - write what the deficit covers and charge it to the shaper, less what earlier turns
+            // already paid for. false if the first frame doesn't fit
+            bool EgressSpend() {
+                size_t written = WriteMessages(EgressDeficit);
+                if (written == 0) {
+                    return false;
+                }
+
+                EgressDeficit -= written;
+                size_t prepaid = std::min(EgressPrepaid, written);
+                EgressPrepaid -= prepaid;
+                shard->egress.Charge(written - prepaid);
+                return true;
+            }
+
+            // io thread - nothing left to send, so this connection stops counting towards its io thread's
+            // backlog and, as with any deficit round robin, loses what it had saved up
+            void EgressIdle() {
+                double joined = EgressJoined.exchange(0, std::memory_order_relaxed);
+                if (joined > 0 && shard) {
+                    shard->egress.Leave(joined);
+                }
+                EgressDeficit = 0;
+                EgressPrepaid = 0;
+            }
+
+            void CountWritten(size_t bytes) {
+                BytesSent.fetch_add(bytes, std::memory_order_relaxed);
+
+                EgressWindowBytes += bytes;
+                auto now = std::chrono::steady_clock::now();
+                double elapsed = std::chrono::duration<double>(now - EgressWindowStart).count();
+                if (elapsed >= 1.0) {
+                    EgressAchieved.store(double(EgressWindowBytes) / elapsed, std::memory_order_relaxed);
+                    EgressWindowBytes = 0;
+                    EgressWindowStart = now;
+                }
+            }
+
+            // ASYNC - prime context to write as many queued messages as fit in the batch limits and budget,
+            // taking them from the lanes in priority order. every header and body goes into one buffer sequence,
+            // so a burst of small messages costs a single writev and a single completion instead of two of each
+            // per message. without a budget the first frame always goes, with one nothing is written
+            // (and 0 returned) unless the first frame fits. returns the bytes the write carries
+            size_t WriteMessages(size_t budget = std::numeric_limits<size_t>::max()) {
+                WriteBuffers.clear();
+                InFlight.clear();
+
+                size_t bytes = 0;
+                while (Pending > 0) {
+                    size_t lane = NextLane();
+                    const auto& next = lanes[lane].queue.front();
+                    size_t frames = InFlight.size();
+                    size_t buffersNeeded = 1 + (next.msg->body.empty() ? 0 : 1) + (next.tail.empty() ? 0 : 1);
+                    size_t frameBytes = QueuedSize(next);
+                    bool fits = frames < WriteHeaders.size() &&
+                                WriteBuffers.size() + buffersNeeded <= options.write_batch_buffers &&
+                                bytes + frameBytes <= options.write_batch_bytes;
+                    if ((frames > 0 && !fits) || bytes + frameBytes > budget) {
+                        break;
+                    }
+
+                    InFlight.push_back({PopLane(lane), lane});
+                    const auto& frame = InFlight.back().frame;
+                    const auto& msg = frame.msg;
+                    size_t headerLength = encode_header(msg->header, Format, WriteHeaders[frames].data());
+                    WriteBuffers.push_back(asio::buffer(WriteHeaders[frames].data(), headerLength));
+                    if (!msg->body.empty()) {
+                        WriteBuffers.push_back(asio::buffer(msg->body.data(), msg->body.size()));
+                    }
+                    if (!frame.tail.empty()) {
+                        WriteBuffers.push_back(asio::buffer(frame.tail.data(), frame.tail.size()));
+                    }
+
+                    bytes += headerLength + msg->body.size() + frame.tail.size();
+                }
+
+                if (InFlight.empty()) {
+                    return 0;
+                }
+
+                Writing = true;
+                asio::async_write(socket, WriteBuffers, [this, self = Self()](std::error_code ec, std::size_t length) {
                     if (!ec) {
-                        messages_out.pop_front();
+                        WriteCalls.fetch_add(1, std::memory_order_relaxed);
+                        FramesWritten.fetch_add(InFlight.size(), std::memory_order_relaxed);
 
-                        if (!messages_out.empty()) {
-                            WriteHeader();
+                        for (const auto& sent : InFlight) {
+                            Dequeued(sent.lane, QueuedSize(sent.frame));
+                            if (sent.frame.stream) {
+                                sent.frame.stream->queued -= QueuedSize(sent.frame);
+                            }
+                        }
+                        // streams cut their next chunks as the earlier ones go out
+                        for (const auto& sent : InFlight) {
+                            if (sent.frame.stream) {
+                                FeedStream(sent.frame.stream);
+                            }
+                        }
+                        InFlight.clear();
+                        Relieved();
+                        CountWritten(length);
+                        if (timers) {
+                            LastWrite = timers->Now();
+                        }
+
+                        if (Pending > 0) {
+                            Flush();
+                        } else {
+                            Writing = false;
+                            EgressIdle();
                         }
                     } else {
-                        std::cout << "[" << id << "] write body fail\n";
-                        socket.close();
+                        std::cout << "[" << id << "] write fail\n";
+                        Writing = false;
+                        Close();
                     }
                 });
+                return bytes;
+            }
+
+            // called once the handshake is complete, sends anything that was queued while it was in progress
+            void StartWriting() {
+                Validated = true;
+                if (Pending > 0) {
+                    Flush();
+                }
             }
 
-            void AddToIncomingMessageQueue() {
+            void StampRead() {
+                if (timers) {
+                    LastRead = timers->Now();
+                }
+            }
+
+            // returns false if reading should pause until the server has caught up
+            bool AddToIncomingMessageQueue() {
+                FramesRead.fetch_add(1, std::memory_order_relaxed);
+
+                // the assembled body is moved into the queue rather than copied, and the next frame
+                // starts on a fresh buffer from the pool. once the message has been handled its body
+                // goes back to the pool, unless the handler held on to it
+                bool more = true;
                 if (OwnerType == owner::server) {
-                    messages_in.push_back({this->shared_from_this(), tempMessageIn});
-                } else {
-                    messages_in.push_back({nullptr, tempMessageIn});
+                    more = Report(IncomingEvent);
+                } else if (IncomingEvent == connection_event::chunk && ChunkSink) {
+                    ChunkSink(tempMessageIn.header.id, read_chunk(tempMessageIn));
+                } else if constexpr (!Threading::inline_handlers) {
+                    messages_in.push_back({nullptr, std::move(tempMessageIn), IncomingEvent});
                 }
 
-                ReadHeader();
+                tempMessageIn.body = typename message<T>::body_type(options.body_pool);
+                return more;
             }
 
-            uint64_t scramble(uint64_t input) {
+            static uint64_t scramble(uint64_t input) {
                 uint64_t out = input ^ 0xfadedbeefcafe;
                 out = (out & 0xabcdef) >> 3 | (out & 0xfedcab) << 12;
                 return out ^ 0xdeadfacade;
             }
 
+            // the top byte of each handshake value carries the wire format negotiation,
+            // the scrambled part never reaches it
+            static constexpr uint64_t HandshakeValueMask = 0x00ffffffffffffff;
+            static constexpr uint8_t HandshakeOfferTag = 0xa0;
+            static constexpr uint8_t HandshakeOfferCompact = 0x01;
+
             void WriteValidation() {
-                asio::async_write(socket, asio::buffer(&HandshakeOut, sizeof(uint64_t)), [this](std::error_code ec, std::size_t length) {
+                asio::async_write(socket, asio::buffer(&HandshakeOut, sizeof(uint64_t)), [this, self = Self()](std::error_code ec, std::size_t) {
                     if (!ec) {
                         if (OwnerType == owner::client) {
-                            ReadHeader();
+                            StartWriting();
+                            ReadIncoming();
                         }
                     } else {
-                        socket.close();
+                        Close();
                     }
                 });
             }
 
-            void ReadValidation(ps::net::server_interface<T>* server = nullptr) {
-                asio::async_read(socket, asio::buffer(&HandshakeIn, sizeof(size_t)), [this, server](std::error_code ec, std::size_t length) {
+            void ReadValidation() {
+                asio::async_read(socket, asio::buffer(&HandshakeIn, sizeof(uint64_t)), [this, self = Self()](std::error_code ec, std::size_t) {
                     if (!ec) {
                         if (OwnerType == owner::server) {
-                            if (HandshakeIn == HandshakeCheck) {
-                                std::cout << "client validated\n";
-                                server->OnClientValidated(this->shared_from_this());
+                            // the client puts the wire format it picked in the top byte of its answer,
+                            // older clients leave it at zero which is the classic format
+                            uint8_t choice = uint8_t(HandshakeIn >> 56);
+                            bool offered = choice == uint8_t(wire_format::classic) ||
+                                           (choice == uint8_t(wire_format::compact) && PreferredFormat == wire_format::compact);
+
+                            if ((HandshakeIn & HandshakeValueMask) == HandshakeCheck && offered) {
+                                Format = wire_format(choice);
+                                server->acceptStats.validated.fetch_add(1, std::memory_order_relaxed);
+                                // the server adds the client and calls OnClientValidated when it reaches this,
+                                // so it sees the client before any of its messages
+                                Report(connection_event::validated);
 
-                                ReadHeader();
+                                StartWriting();
+                                StartTimers();
+                                ReadIncoming();
                             } else {
                                 std::cout << "client disconnected (fail validation)\n";
+                                Close();
                             }
                         } else {
-                            HandshakeOut = scramble(HandshakeIn);
+                            // only use the compact format if the server advertised it and we want it
+                            uint8_t offer = uint8_t(HandshakeIn >> 56);
+                            bool compactOffered = (offer & 0xf0) == HandshakeOfferTag && (offer & HandshakeOfferCompact);
+                            Format = (compactOffered && PreferredFormat == wire_format::compact) ? wire_format::compact : wire_format::classic;
+
+                            HandshakeOut = HandshakeAnswer(HandshakeIn, Format);
 
                             WriteValidation();
                         }
                     } else {
                         std::cout << "client disconnected (read validation)\n";
-                        socket.close();
+                        Close();
                     }
                 });
             }
@@ -214,21 +1246,151 @@ namespace ps {
             // this context is shared across the whole asio instance
             asio::io_context& context;
 
-            // queue that holds all messages to be sent to the remote side of this connection
-            tsqueue<message<T>> messages_out;
+            // a stream SendChunked is sending: its payload, shared rather than copied, the lane it goes on, how far
+            // into the payload the queued chunks reach and what of it is queued or being written. aborted once a chunk
+            // was dropped, done once the last chunk (or the abort) is queued. only touched on the io thread
+            struct outbound_stream {
+                shared_message<T> source;
+                uint32_t id = 0;
+                size_t chunkSize = 0;
+                size_t lane = 0;
+                size_t offset = 0;
+                size_t queued = 0;
+                bool aborted = false;
+                bool done = false;
+            };
+
+            // one frame waiting to be sent: a message, or a stream's chunk whose prefix is msg and whose data
+            // (tail) points into the stream's payload
+            struct outbound_frame {
+                shared_message<T> msg;
+                std::shared_ptr<outbound_stream> stream;
+                std::span<const uint8_t> tail;
+            };
+
+            // one outbound priority lane: its queue of frames waiting to be sent to the remote side, with the
+            // lane's weight and deficit for the bulk lanes' turns. messages are shared so a broadcast doesn't copy
+            // the body into every queue. the queue is only ever touched on the io thread, so it needs no lock,
+            // the counts include the lane's frames in the write in flight and are added to by Send
+            struct outbound_lane {
+                std::deque<outbound_frame> queue;
+                size_t weight = 1;
+                size_t deficit = 0;
+                std::atomic<size_t> bytes{0};
+                std::atomic<size_t> messages{0};
+            };
+
+            // the control lane and then the bulk lanes, how many messages they hold between them, and the bulk
+            // lane whose turn it is (and whether it has had its quantum for this turn)
+            std::vector<outbound_lane> lanes;
+            size_t Pending = 0;
+            size_t BulkTurn = 1;
+            bool BulkTopped = false;
 
             // queue that holds all messages that have been received from the remote side of this connection.
             // this queue is a reference because the owner of this connection (client) is expected to provide a queue.
-            tsqueue<owned_message<T>>& messages_in;
+            incoming_queue& messages_in;
 
             // incoming messages are constructed asynchronously, so we will
             // store part of the assembled message here until its ready
             message<T> tempMessageIn;
 
+            // bytes read from the socket that haven't been parsed into frames yet, and whether
+            // tempMessageIn is a whole message or one chunk of a stream
+            std::vector<uint8_t> ReceiveBuffer;
+            size_t ReceiveEnd = 0;
+            connection_event IncomingEvent = connection_event::message;
+
+            // the last stream id handed out by OpenStream, and a client's chunk sink
+            std::atomic<uint32_t> NextStream{0};
+            std::function<void(T id, const stream_chunk& chunk)> ChunkSink;
+
+            // reads from the socket, and frames they delivered
+            std::atomic<uint64_t> ReadCalls{0};
+            std::atomic<uint64_t> FramesRead{0};
+
+            // the batch of frames currently being written: the frames and the lanes they came from (which keep
+            // the bodies alive until the write completes), their encoded headers and the buffer sequence pointing
+            // at the headers and bodies
+            struct in_flight {
+                outbound_frame frame;
+                size_t lane;
+            };
+
+            connection_options options;
+            std::vector<in_flight> InFlight;
+            std::vector<std::array<uint8_t, max_header_size<T>>> WriteHeaders;
+            std::vector<asio::const_buffer> WriteBuffers;
+            bool Writing = false;
+
+            // gathered writes issued, and frames they carried
+            std::atomic<uint64_t> WriteCalls{0};
+            std::atomic<uint64_t> FramesWritten{0};
+
+            // what is waiting in the lanes or being written, added to by Send on the caller's thread and taken off by the io thread
+            std::atomic<size_t> OutboundBytes{0};
+            std::atomic<size_t> OutboundMessages{0};
+            std::atomic<bool> Congested{false};
+            std::atomic<uint64_t> Dropped{0};
+
+            // this connection's place on its io thread's egress shaper: its weight, the weight it joined the
+            // backlog with (zero while it has nothing to send), what it has saved up towards its next frame and
+            // how much of that the shaper has already been charged for. the rest measures what it actually achieved
+            std::atomic<double> EgressWeight{1.0};
+            std::atomic<double> EgressJoined{0};
+            size_t EgressDeficit = 0;
+            size_t EgressPrepaid = 0;
+            std::atomic<uint64_t> BytesSent{0};
+            std::atomic<double> EgressAchieved{0};
+            std::chrono::steady_clock::time_point EgressWindowStart;
+            uint64_t EgressWindowBytes = 0;
+
+            // the server sets id from the thread running Update
+            friend class server_interface<T, Threading>;
+
+            // what has been received and not yet taken by Update, and whether reading stopped because it
+            // filled up. ReadPaused is guarded by the queue's lock. Received is what the read being parsed has
+            // delivered so far, only touched on the io thread
+            std::conditional_t<Threading::inline_handlers, compiled_out, dispatch_mailbox<T>> Inbound;
+            bool ReadPaused = false;
+            std::conditional_t<Threading::inline_handlers, compiled_out, std::vector<owned_message<T>>> Received;
+
+            // the client's rate limit, only touched on the io thread. a throttled connection isn't reading,
+            // and SkipRemaining is what is still to arrive of a dropped frame
+            token_bucket MessageTokens;
+            token_bucket ByteTokens;
+            rate_limit_policy LimitPolicy = rate_limit_policy::throttle;
+            std::chrono::steady_clock::time_point LastRefill;
+            bool Throttled = false;
+            size_t SkipRemaining = 0;
+            std::atomic<uint64_t> RateLimited{0};
+
+            // messages waiting for a dispatch worker, when the server runs handlers in parallel
+            std::conditional_t<Threading::inline_handlers, compiled_out, dispatch_mailbox<T>> Inbox;
+            friend class dispatch_pool<T>;
+
+            // the server that accepted this connection, nullptr on the client side
+            server_interface<T, Threading>* server = nullptr;
+
+            // the io thread this connection lives on and its timing wheel, nullptr on the client side,
+            // and the ticks the last read and write completed on
+            io_shard* shard = nullptr;
+            timing_wheel* timers = nullptr;
+            shared_message<T> heartbeat;
+            uint64_t LastRead = 0;
+            uint64_t LastWrite = 0;
+            bool DisconnectNotified = false;
+
+            // the format this side would like to use, and the one the handshake settled on
+            wire_format PreferredFormat = wire_format::classic;
+            wire_format Format = wire_format::classic;
+            bool Validated = false;
+
             // the "owner" decides how some of the connection behaves
             owner OwnerType = owner::server;
 
-            uint32_t id = 0;
+            // written once by the server, read by the io thread for logging
+            std::atomic<uint32_t> id{0};
 
             uint64_t HandshakeOut = 0;
             uint64_t HandshakeIn = 0;
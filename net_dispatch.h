@@ -0,0 +1,201 @@
+// Created by psdab on 5/2/2024.
+
+#ifndef BETTER_SERVER_NET_DISPATCH_H
+#define BETTER_SERVER_NET_DISPATCH_H
+#pragma once
+
+#include "net_common.h"
+#include "net_message.h"
+
+#include <condition_variable>
+#include <functional>
+
+namespace ps {
+    namespace net {
+        // counters for a dispatch_pool, readable from any thread
+        struct dispatch_stats {
+            std::atomic<uint64_t> dispatched{0};  // messages and events handed to a worker
+            std::atomic<uint64_t> steals{0};      // mailboxes a worker took from another worker's queue
+        };
+
+        // the messages a connection has waiting for Update or a dispatch worker. a mailbox is only ever
+        // scheduled with one consumer at a time, which is what keeps a client's messages in order
+        template <typename T>
+        struct dispatch_mailbox {
+            std::mutex mux;
+            std::deque<owned_message<T>> items;
+            bool scheduled = false;
+        };
+
+        // a pool of workers that runs message handlers in parallel across connections and in order within
+        // each one. a connection with work waiting is queued on its home worker, and a worker that runs
+        // out of its own work steals from the others, so one busy shard doesn't leave the rest idle
+        template <typename T>
+        class dispatch_pool {
+        public:
+            using handler = std::function<void(owned_message<T>&)>;
+
+            dispatch_pool() = default;
+
+            dispatch_pool(const dispatch_pool&) = delete;
+            dispatch_pool& operator=(const dispatch_pool&) = delete;
+
+            ~dispatch_pool() {
+                Stop();
+            }
+
+            // quantum is how many messages a worker takes from one mailbox before giving others a turn
+            void Start(size_t threads, handler fn, size_t quantum = 32) {
+                handle = std::move(fn);
+                this->quantum = std::max<size_t>(quantum, 1);
+                stopping = false;
+
+                workers.clear();
+                for (size_t i = 0; i < std::max<size_t>(threads, 1); i++) {
+                    workers.push_back(std::make_unique<worker>());
+                }
+                for (size_t i = 0; i < workers.size(); i++) {
+                    workers[i]->thread = std::thread([this, i]() { Run(i); });
+                }
+            }
+
+            // finishes whatever is already scheduled before the workers exit
+            void Stop() {
+                {
+                    std::scoped_lock lock(muxIdle);
+                    stopping = true;
+                }
+                cvIdle.notify_all();
+
+                for (auto& w : workers) {
+                    if (w->thread.joinable()) { w->thread.join(); }
+                }
+                workers.clear();
+            }
+
+            bool Running() const {
+                return !workers.empty();
+            }
+
+            // hand msg to its connection's mailbox, scheduling the mailbox if it was idle
+            void Dispatch(owned_message<T> msg) {
+                std::shared_ptr<connection<T>> target = msg.remote;
+                auto& box = target->Inbox;
+
+                bool schedule;
+                {
+                    std::scoped_lock lock(box.mux);
+                    box.items.push_back(std::move(msg));
+                    schedule = !box.scheduled;
+                    box.scheduled = true;
+                }
+
+                stats.dispatched.fetch_add(1, std::memory_order_relaxed);
+                if (schedule) {
+                    // a connection always starts on the same worker, which keeps its state in that core's cache
+                    Enqueue(std::hash<connection<T>*>{}(target.get()) % workers.size(), std::move(target));
+                }
+            }
+
+            const dispatch_stats& Stats() const {
+                return stats;
+            }
+
+        private:
+            struct worker {
+                std::mutex mux;
+                std::deque<std::shared_ptr<connection<T>>> ready;
+                std::thread thread;
+            };
+
+            void Enqueue(size_t index, std::shared_ptr<connection<T>> target) {
+                {
+                    std::scoped_lock lock(workers[index]->mux);
+                    workers[index]->ready.push_back(std::move(target));
+                }
+                {
+                    std::scoped_lock lock(muxIdle);
+                    pending++;
+                }
+                cvIdle.notify_one();
+            }
+
+            // own queue from the front, other queues from the back
+            std::shared_ptr<connection<T>> Take(size_t index) {
+                {
+                    auto& own = *workers[index];
+                    std::scoped_lock lock(own.mux);
+                    if (!own.ready.empty()) {
+                        auto target = std::move(own.ready.front());
+                        own.ready.pop_front();
+                        return target;
+                    }
+                }
+
+                for (size_t n = 1; n < workers.size(); n++) {
+                    auto& victim = *workers[(index + n) % workers.size()];
+                    std::scoped_lock lock(victim.mux);
+                    if (!victim.ready.empty()) {
+                        auto target = std::move(victim.ready.back());
+                        victim.ready.pop_back();
+                        stats.steals.fetch_add(1, std::memory_order_relaxed);
+                        return target;
+                    }
+                }
+                return nullptr;
+            }
+
+            void Run(size_t index) {
+                while (true) {
+                    {
+                        std::unique_lock lock(muxIdle);
+                        cvIdle.wait(lock, [this]() { return pending > 0 || stopping; });
+                        if (pending == 0) {
+                            return;
+                        }
+                        pending--;
+                    }
+
+                    // a mailbox is queued before pending counts it and every worker takes one per count,
+                    // so there is always one to find here, if not necessarily on our own queue
+                    if (auto target = Take(index)) {
+                        Drain(index, std::move(target));
+                    }
+                }
+            }
+
+            void Drain(size_t index, std::shared_ptr<connection<T>> target) {
+                auto& box = target->Inbox;
+                for (size_t n = 0; n < quantum; n++) {
+                    owned_message<T> msg;
+                    {
+                        std::scoped_lock lock(box.mux);
+                        if (box.items.empty()) {
+                            box.scheduled = false;
+                            return;
+                        }
+                        msg = std::move(box.items.front());
+                        box.items.pop_front();
+                    }
+                    handle(msg);
+                }
+
+                // still busy, go to the back of the queue so other connections get a turn
+                Enqueue(index, std::move(target));
+            }
+
+            std::vector<std::unique_ptr<worker>> workers;
+            handler handle;
+            size_t quantum = 32;
+
+            std::mutex muxIdle;
+            std::condition_variable cvIdle;
+            size_t pending = 0;
+            bool stopping = false;
+
+            dispatch_stats stats;
+        };
+    }
+}
+
+#endif
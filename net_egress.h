@@ -0,0 +1,128 @@
+// Created by psdab on 5/2/2024.
+
+#ifndef BETTER_SERVER_NET_EGRESS_H
+#define BETTER_SERVER_NET_EGRESS_H
+#pragma once
+
+#include "net_common.h"
+#include "net_rate_limit.h"
+
+#include <functional>
+
+namespace ps {
+    namespace net {
+        // caps how many bytes one io thread writes per second and shares that between its connections by weight.
+        // a connection with something to write waits for its turn, and each turn (deficit round robin) adds
+        // quantum * weight to what it may send. while the bucket is empty nobody gets a turn until it has refilled.
+        // everything happens on the thread running the context, the limit and weights are only read elsewhere
+        class egress_shaper {
+        public:
+            // a connection's turn: given the quantum it earned, it writes what fits and returns true
+            // if it is still waiting because its first frame needs more turns. either way it charges what the turn used
+            using turn = std::function<bool(size_t quantum)>;
+
+            explicit egress_shaper(asio::io_context& context) : timer(context) {}
+
+            egress_shaper(const egress_shaper&) = delete;
+            egress_shaper& operator=(const egress_shaper&) = delete;
+
+            // zero removes the cap, and whoever is waiting gets to write straight away.
+            // the bucket holds 20ms worth (at least a quantum), so output stays smooth
+            void SetLimit(double bytes_per_sec, size_t quantum = 16 * 1024) {
+                this->quantum = std::max<size_t>(quantum, 1);
+                bucket.reset(bytes_per_sec, std::max(bytes_per_sec / 50.0, double(this->quantum)));
+                limit.store(bytes_per_sec, std::memory_order_relaxed);
+                LastRefill = std::chrono::steady_clock::now();
+                Pump();
+            }
+
+            bool Enabled() const {
+                return bucket.enabled();
+            }
+
+            // queue a connection for its next turn, it must not already be waiting
+            void Wait(double weight, turn fn) {
+                waiting.push_back({weight, std::move(fn)});
+                Pump();
+            }
+
+            // bytes a connection has just started writing
+            void Charge(size_t bytes) {
+                bucket.take(double(bytes));
+            }
+
+            // the total weight of the connections with something to send, kept up to date by the connections
+            void Join(double weight) {
+                backlog.store(backlog.load(std::memory_order_relaxed) + weight, std::memory_order_relaxed);
+            }
+
+            void Leave(double weight) {
+                backlog.store(std::max(0.0, backlog.load(std::memory_order_relaxed) - weight), std::memory_order_relaxed);
+            }
+
+            // any thread - the bytes/sec a connection with this weight should get while it keeps the queue busy,
+            // zero when there is no cap
+            double Share(double weight, bool backlogged) const {
+                double total = backlog.load(std::memory_order_relaxed) + (backlogged ? 0.0 : weight);
+                return total > 0 ? limit.load(std::memory_order_relaxed) * weight / total : 0.0;
+            }
+
+        private:
+            struct entry {
+                double weight;
+                turn fn;
+            };
+
+            void Pump() {
+                if (!Enabled()) {
+                    // no cap, everyone gets as much as they want
+                    while (!waiting.empty()) {
+                        entry e = std::move(waiting.front());
+                        waiting.pop_front();
+                        e.fn(std::numeric_limits<size_t>::max());
+                    }
+                    return;
+                }
+
+                auto now = std::chrono::steady_clock::now();
+                bucket.refill(std::chrono::duration<double>(now - LastRefill).count());
+                LastRefill = now;
+
+                // a turn either writes (and the connection comes back once its deficit is spent) or saves up
+                // towards a big frame, and both are charged, so the bucket runs out before anyone jumps ahead of the limit
+                while (!waiting.empty() && bucket.ready(1)) {
+                    entry e = std::move(waiting.front());
+                    waiting.pop_front();
+                    if (e.fn(size_t(double(quantum) * std::max(e.weight, 0.01)))) {
+                        waiting.push_back(std::move(e));
+                    }
+                }
+
+                if (!waiting.empty() && !Armed) {
+                    Armed = true;
+                    auto wait = std::chrono::duration<double>(std::max(bucket.wait(1), 0.001));
+                    timer.expires_after(std::chrono::duration_cast<std::chrono::steady_clock::duration>(wait));
+                    timer.async_wait([this](std::error_code ec) {
+                        Armed = false;
+                        if (!ec) {
+                            Pump();
+                        }
+                    });
+                }
+            }
+
+            asio::steady_timer timer;
+            bool Armed = false;
+
+            token_bucket bucket;
+            std::chrono::steady_clock::time_point LastRefill;
+            size_t quantum = 16 * 1024;
+            std::deque<entry> waiting;
+
+            std::atomic<double> limit{0};
+            std::atomic<double> backlog{0};
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,111 @@
+// Created by psdab on 5/2/2024.
+
+#ifndef BETTER_SERVER_NET_IO_POOL_H
+#define BETTER_SERVER_NET_IO_POOL_H
+#pragma once
+
+#include "net_common.h"
+#include "net_timer_wheel.h"
+#include "net_egress.h"
+
+namespace ps {
+    namespace net {
+        // one io thread: its context, the timing wheel and egress shaper for the connections living on it,
+        // and how many of them there are. a connection never moves to another shard,
+        // so everything it does happens on this thread and needs no locking
+        struct io_shard {
+            io_shard() : timers(context), egress(context), work(asio::make_work_guard(context)) {}
+
+            io_shard(const io_shard&) = delete;
+            io_shard& operator=(const io_shard&) = delete;
+
+            // declared before the context so it is still there when connections are destroyed with it
+            std::atomic<size_t> connections{0};
+
+            asio::io_context context;
+            timing_wheel timers;
+            egress_shaper egress;
+            asio::executor_work_guard<asio::io_context::executor_type> work;
+            std::thread thread;
+        };
+
+        // how new connections are spread over the shards
+        enum class shard_policy : uint8_t {
+            round_robin,  // each shard in turn
+            least_loaded  // the shard with the fewest live connections
+        };
+
+        // a fixed set of io threads, each running its own context
+        class io_pool {
+        public:
+            explicit io_pool(size_t threads = 1) {
+                threads = std::max<size_t>(threads, 1);
+                for (size_t i = 0; i < threads; i++) {
+                    shards.push_back(std::make_unique<io_shard>());
+                }
+            }
+
+            io_pool(const io_pool&) = delete;
+            io_pool& operator=(const io_pool&) = delete;
+
+            ~io_pool() {
+                Stop();
+            }
+
+            // call once any initial work (e.g. the first accept) has been primed
+            void Start() {
+                for (auto& shard : shards) {
+                    shard->timers.Start();
+                    shard->thread = std::thread([s = shard.get()]() { s->context.run(); });
+                }
+            }
+
+            void Stop() {
+                for (auto& shard : shards) {
+                    shard->context.stop();
+                }
+                for (auto& shard : shards) {
+                    if (shard->thread.joinable()) { shard->thread.join(); }
+                }
+            }
+
+            // the shard that owns anything not tied to a connection, like the acceptor
+            io_shard& Primary() {
+                return *shards[0];
+            }
+
+            // where the next connection should live. only called from one thread at a time (the accepting one)
+            io_shard& Pick(shard_policy policy) {
+                if (shards.size() == 1) {
+                    return *shards[0];
+                }
+
+                if (policy == shard_policy::least_loaded) {
+                    io_shard* best = shards[0].get();
+                    for (auto& shard : shards) {
+                        if (shard->connections.load(std::memory_order_relaxed) < best->connections.load(std::memory_order_relaxed)) {
+                            best = shard.get();
+                        }
+                    }
+                    return *best;
+                }
+
+                return *shards[next++ % shards.size()];
+            }
+
+            size_t size() const {
+                return shards.size();
+            }
+
+            io_shard& operator[](size_t i) {
+                return *shards[i];
+            }
+
+        private:
+            std::vector<std::unique_ptr<io_shard>> shards;
+            size_t next = 0;
+        };
+    }
+}
+
+#endif
@@ -5,6 +5,16 @@
 #pragma once
 
 #include "net_common.h"
+#include "net_buffer.h"
+#include "net_serialize.h"
+#include "net_byteorder.h"
+#include "net_varint.h"
+#include "net_threading.h"
+
+#include <ranges>
+#include <span>
+#include <string_view>
+#include <stdexcept>
 
 namespace ps {
     namespace net {
@@ -14,10 +24,100 @@ namespace ps {
             uint32_t size = 0; // size of the message
         };
 
+        // how a message header is laid out on the wire. classic sends the header struct as is
+        // (sizeof(T) + 4 bytes), compact sends the id and the body length as varints, so most small
+        // messages carry a 2 byte header. the format is agreed per connection during the handshake
+        enum class wire_format : uint8_t {
+            classic = 0,
+            compact = 1
+        };
+
+        template <typename T>
+        constexpr size_t max_header_size = std::max(sizeof(message_header<T>), max_varint_size + 5);
+
+        // writes the header in the given format and returns how many bytes it took
+        template <typename T>
+        size_t encode_header(const message_header<T>& header, wire_format format, uint8_t* out) {
+            if (format == wire_format::compact) {
+                using id_type = std::make_unsigned_t<typename std::conditional_t<std::is_enum_v<T>, std::underlying_type<T>, std::type_identity<T>>::type>;
+                uint8_t* end = write_varint(out, uint64_t(id_type(header.id)));
+                end = write_varint(end, header.size);
+                return size_t(end - out);
+            }
+
+            std::memcpy(out, &header, sizeof(message_header<T>));
+            return sizeof(message_header<T>);
+        }
+
+        // what decode_header returns for a header that can never be valid
+        constexpr size_t malformed_header = std::numeric_limits<size_t>::max();
+
+        // reads a header in the given format, returns how many bytes it took, 0 if length bytes aren't a complete
+        // header yet, or malformed_header if a compact field doesn't fit the header (rather than wrapping it)
         template <typename T>
+        size_t decode_header(const uint8_t* in, size_t length, wire_format format, message_header<T>& header) {
+            if (format == wire_format::compact) {
+                using id_type = std::make_unsigned_t<typename std::conditional_t<std::is_enum_v<T>, std::underlying_type<T>, std::type_identity<T>>::type>;
+                uint64_t id = 0;
+                uint64_t size = 0;
+                size_t idLength = read_varint(in, length, id);
+                if (idLength == 0) { return 0; }
+                size_t sizeLength = read_varint(in + idLength, length - idLength, size);
+                if (sizeLength == 0) { return 0; }
+                if (id > std::numeric_limits<id_type>::max() || size > std::numeric_limits<uint32_t>::max()) {
+                    return malformed_header;
+                }
+
+                header.id = T(id_type(id));
+                header.size = uint32_t(size);
+                return idLength + sizeLength;
+            }
+
+            if (length < sizeof(message_header<T>)) { return 0; }
+            std::memcpy(&header, in, sizeof(message_header<T>));
+            return sizeof(message_header<T>);
+        }
+
+        // wraps a string, array or unsigned integer so its length (or value) is pushed/pulled as a varint
+        // instead of a full size_t, e.g. msg << compact(name);
+        template <typename Datatype>
+        struct compact_t {
+            Datatype& item;
+        };
+
+        template <typename Datatype>
+        compact_t<Datatype> compact(Datatype& item) {
+            return {item};
+        }
+
+        template <typename Datatype>
+        compact_t<const Datatype> compact(const Datatype& item) {
+            return {item};
+        }
+
+        // how message_writer/message_reader store the length of strings and arrays
+        enum class length_prefix : uint8_t {
+            fixed,  // 4 byte uint32_t
+            varint  // 1 byte for anything under 128
+        };
+
+        // contiguous runs of elements (std::vector, std::span, ...) are pushed as one block followed by
+        // their element count, the same way strings are. fixed size arrays don't need a count and are
+        // pushed like any other fixed layout type
+        template <typename Range>
+        constexpr bool is_bulk_range_v = std::ranges::contiguous_range<Range> && std::ranges::sized_range<Range>
+                && !detail::is_std_array<Range>::value && !std::is_array_v<Range> && !std::is_same_v<Range, std::string>;
+
+        // bodies up to this many bytes are stored inside the message itself instead of on the heap,
+        // unless the message asks for another size. connections send and receive the default
+        constexpr size_t message_inline_body = 64;
+
+        template <typename T, size_t InlineBody = message_inline_body>
         struct message {
+            using body_type = body_buffer<InlineBody>;
+
             message_header<T> header{};
-            std::vector<uint8_t> body;
+            body_type body;
 
             // returns the size of the message in bytes
             size_t size() const {
@@ -25,14 +125,13 @@ namespace ps {
             }
 
             // override for std::cout compatibility
-            friend std::ostream& operator<<(std::ostream& os, const message<T> msg) {
+            friend std::ostream& operator<<(std::ostream& os, const message& msg) {
                 os << "id: " << int(msg.header.id) << "size: " << msg.header.size;
                 return os;
             }
 
             // operator overloads for dealing with strings in messages
-            template <typename Datatype>
-            friend ps::net::message<Datatype>& operator<<(ps::net::message<Datatype>& msg, const std::string& str) {
+            friend message& operator<<(message& msg, const std::string& str) {
                 size_t stringSize = str.size();
                 size_t originalSize = msg.size();
 
@@ -44,10 +143,12 @@ namespace ps {
                 msg.header.size = msg.size();
                 return msg;
             };
-            template <typename Datatype>
-            friend ps::net::message<Datatype>& operator>>(ps::net::message<Datatype>& msg, std::string& str) {
+            friend message& operator>>(message& msg, std::string& str) {
                 size_t stringSize;
                 msg >> stringSize;
+                if (stringSize > msg.body.size()) {
+                    throw std::out_of_range("pulled more than the message body holds");
+                }
 
                 size_t start = msg.body.size() - stringSize;
                 str.resize(stringSize);
@@ -58,59 +159,421 @@ namespace ps {
                 return msg;
             }
 
-            // operator overloads for dealing with standard layout data types in messages
+            // operator overloads for dealing with fixed layout data types in messages.
+            // structs are laid out by net_serialize.h: their encoded size is known at compile time,
+            // so the body grows once and the whole struct is copied in a single pass.
+            // contiguous ranges are copied as a single block followed by their count
             template <typename Datatype, typename = std::enable_if_t<!std::is_same_v<Datatype, std::string>>>
-            friend message<T>& operator<<(message<T>& msg, const Datatype& data) {
-                // check that the type of data being pushed is trivially copyable
-                static_assert(std::is_standard_layout<Datatype>::value, "data is too complex to be pushed into vector");
+            friend message& operator<<(message& msg, const Datatype& data) {
+                if constexpr (is_bulk_range_v<Datatype>) {
+                    using Item = std::remove_cv_t<std::ranges::range_value_t<Datatype>>;
+                    size_t count = std::ranges::size(data);
+                    size_t i = msg.body.size();
 
-                // cache the current size of the body vector
-                size_t i = msg.body.size();
+                    // one resize for the whole block and its count
+                    msg.body.resize(i + count * wire_size_v<Item> + sizeof(size_t));
+                    uint8_t* end = wire_encode_n(msg.body.data() + i, std::ranges::data(data), count);
+                    std::memcpy(end, &count, sizeof(size_t));
+
+                    msg.header.size = msg.size();
+                    return msg;
+                } else {
+                    // check that the data has a fixed layout with no pointers or padding
+                    static_assert(is_wire_type<Datatype>(), "data is too complex to be pushed into vector");
+
+                    // cache the current size of the body vector
+                    size_t i = msg.body.size();
 
-                // resize the vector by the size of the data being pushed
-                msg.body.resize(msg.body.size() + sizeof(Datatype));
+                    // resize the vector by the encoded size of the data being pushed
+                    msg.body.resize(i + wire_size_v<Datatype>);
 
-                // copy the data into the newly allocated vector space
-                std::memcpy(msg.body.data() + i, &data, sizeof(Datatype));
+                    // copy the data into the newly allocated vector space
+                    wire_encode(msg.body.data() + i, data);
+
+                    // re-evaluate message size
+                    msg.header.size = msg.size();
+
+                    // return the target message so it can be chained
+                    return msg;
+                }
+            }
+            template <typename Datatype, typename = std::enable_if_t<!std::is_same_v<Datatype, std::string>>>
+            friend message& operator>>(message& msg, Datatype& data) {
+                if constexpr (is_bulk_range_v<Datatype>) {
+                    using Item = std::remove_cv_t<std::ranges::range_value_t<Datatype>>;
+                    size_t count;
+                    msg >> count;
+
+                    // the count comes from the remote, so it is checked against what is actually there
+                    // before anything is sized by it
+                    if (count > msg.body.size() / wire_size_v<Item>) {
+                        throw std::out_of_range("pulled more than the message body holds");
+                    }
+
+                    // containers are sized to fit, fixed views (std::span) must already be the right size
+                    if constexpr (requires { data.resize(count); }) {
+                        data.resize(count);
+                    } else if (std::ranges::size(data) != count) {
+                        throw std::length_error("pulled array does not match the size of the destination");
+                    }
+
+                    size_t i = msg.body.size() - count * wire_size_v<Item>;
+                    wire_decode_n(msg.body.data() + i, std::ranges::data(data), count);
+
+                    msg.body.resize(i);
+                    msg.header.size = msg.size();
+                    return msg;
+                } else {
+                    // check that the data has a fixed layout with no pointers or padding
+                    static_assert(is_wire_type<Datatype>(), "data is too complex to be pushed into vector");
+                    if (msg.body.size() < wire_size_v<Datatype>) {
+                        throw std::out_of_range("pulled more than the message body holds");
+                    }
+
+                    // cache the location towards the end of the vector where the pulled data starts
+                    size_t i = msg.body.size() - wire_size_v<Datatype>;
+
+                    // copy data from the vector into the data variable
+                    wire_decode(msg.body.data() + i, data);
+
+                    // shrink the vector to remove read bytes, and reset end position
+                    msg.body.resize(i);
+
+                    // re-evaluate message size
+                    msg.header.size = msg.size();
+
+                    // return the target message so it can be chained
+                    return msg;
+                }
+            }
+
+            // strings, arrays and unsigned integers wrapped in compact(...) store their length (or value) as a varint.
+            // its bytes are written back to front so it can still be pulled off the end of the body
+            template <typename Datatype>
+            friend message& operator<<(message& msg, compact_t<Datatype> wrapped) {
+                using Item = std::remove_cv_t<Datatype>;
+                size_t i = msg.body.size();
+
+                if constexpr (std::is_unsigned_v<Item>) {
+                    msg.body.resize(i + varint_size(wrapped.item));
+                    write_varint_reversed(msg.body.data() + i, wrapped.item);
+                } else if constexpr (std::is_convertible_v<const Item&, std::string_view>) {
+                    std::string_view str = wrapped.item;
+                    msg.body.resize(i + str.size() + varint_size(str.size()));
+                    std::memcpy(msg.body.data() + i, str.data(), str.size());
+                    write_varint_reversed(msg.body.data() + i + str.size(), str.size());
+                } else {
+                    static_assert(is_bulk_range_v<Item>, "only strings, arrays and unsigned integers can be pushed compact");
+                    using Element = std::remove_cv_t<std::ranges::range_value_t<Item>>;
+                    size_t count = std::ranges::size(wrapped.item);
+                    msg.body.resize(i + count * wire_size_v<Element> + varint_size(count));
+                    uint8_t* end = wire_encode_n(msg.body.data() + i, std::ranges::data(wrapped.item), count);
+                    write_varint_reversed(end, count);
+                }
 
-                // re-evaluate message size
                 msg.header.size = msg.size();
+                return msg;
+            }
+            template <typename Datatype>
+            friend message& operator>>(message& msg, compact_t<Datatype> wrapped) {
+                static_assert(!std::is_const_v<Datatype>, "can't pull into a const value");
 
-                // return the target message so it can be chained
+                uint64_t value = 0;
+                size_t used = read_varint_reversed(msg.body.data() + msg.body.size(), msg.body.size(), value);
+                if (used == 0) {
+                    throw std::length_error("message doesn't end with a varint");
+                }
+                size_t end = msg.body.size() - used;
+
+                // like any count from the remote, the value is checked before it is trusted
+                if constexpr (std::is_unsigned_v<Datatype>) {
+                    if (value > std::numeric_limits<Datatype>::max()) {
+                        throw std::out_of_range("pulled varint doesn't fit the destination");
+                    }
+                    wrapped.item = Datatype(value);
+                    msg.body.resize(end);
+                } else if constexpr (std::is_same_v<Datatype, std::string>) {
+                    if (value > end) {
+                        throw std::out_of_range("pulled more than the message body holds");
+                    }
+                    size_t start = end - value;
+                    wrapped.item.assign(reinterpret_cast<const char*>(msg.body.data() + start), value);
+                    msg.body.resize(start);
+                } else {
+                    static_assert(is_bulk_range_v<Datatype>, "only strings, arrays and unsigned integers can be pulled compact");
+                    using Element = std::remove_cv_t<std::ranges::range_value_t<Datatype>>;
+                    if (value > end / wire_size_v<Element>) {
+                        throw std::out_of_range("pulled more than the message body holds");
+                    }
+                    size_t count = size_t(value);
+                    if constexpr (requires { wrapped.item.resize(count); }) {
+                        wrapped.item.resize(count);
+                    } else if (std::ranges::size(wrapped.item) != count) {
+                        throw std::length_error("pulled array does not match the size of the destination");
+                    }
+                    size_t start = end - count * wire_size_v<Element>;
+                    wire_decode_n(msg.body.data() + start, std::ranges::data(wrapped.item), count);
+                    msg.body.resize(start);
+                }
+
+                msg.header.size = msg.size();
                 return msg;
             }
-            template <typename Datatype, typename = std::enable_if_t<!std::is_same_v<Datatype, std::string>>>
-            friend message<T>& operator>>(message<T>& msg, Datatype& data) {
-                // check that the type of the data being pulled is trivially copyable
-                static_assert(std::is_standard_layout<Datatype>::value, "data is too complex to be pushed into vector");
 
-                // cache the location towards the end of the vector where the pulled data starts
-                size_t i = msg.body.size() - sizeof(Datatype);
+            // arrays of numbers wrapped in network_order(...) are stored big endian. the byte swap is done
+            // with vector shuffles where available, so peers of either endianness agree for almost no cost.
+            // the element count itself stays in host order like every other field
+            template <typename Range>
+            friend message& operator<<(message& msg, network_order_t<Range> wrapped) {
+                using Item = std::remove_cv_t<std::ranges::range_value_t<Range>>;
+                static_assert(std::is_arithmetic_v<Item> || std::is_enum_v<Item>, "only arrays of numbers have a network byte order");
+                constexpr bool counted = is_bulk_range_v<std::remove_cv_t<Range>>;
 
-                // copy data from the vector into the data variable
-                std::memcpy(&data, msg.body.data() + i, sizeof(Datatype));
+                size_t count = std::ranges::size(wrapped.items);
+                size_t i = msg.body.size();
 
-                // shrink the vector to remove read bytes, and reset end position
-                msg.body.resize(i);
+                msg.body.resize(i + count * sizeof(Item) + (counted ? sizeof(size_t) : 0));
+                copy_network_order<sizeof(Item)>(msg.body.data() + i, reinterpret_cast<const uint8_t*>(std::ranges::data(wrapped.items)), count);
+                if constexpr (counted) {
+                    std::memcpy(msg.body.data() + i + count * sizeof(Item), &count, sizeof(size_t));
+                }
 
-                // re-evaluate message size
                 msg.header.size = msg.size();
+                return msg;
+            }
+            template <typename Range>
+            friend message& operator>>(message& msg, network_order_t<Range> wrapped) {
+                using Item = std::remove_cv_t<std::ranges::range_value_t<Range>>;
+                static_assert(std::is_arithmetic_v<Item> || std::is_enum_v<Item>, "only arrays of numbers have a network byte order");
+                static_assert(!std::is_const_v<Range>, "can't pull into a const array");
+
+                size_t count = std::ranges::size(wrapped.items);
+                if constexpr (is_bulk_range_v<Range>) {
+                    msg >> count;
+                }
+                // a pulled count comes from the remote, so check it against what is actually there
+                if (count > msg.body.size() / sizeof(Item)) {
+                    throw std::out_of_range("pulled more than the message body holds");
+                }
+                if constexpr (is_bulk_range_v<Range>) {
+                    if constexpr (requires { wrapped.items.resize(count); }) {
+                        wrapped.items.resize(count);
+                    } else if (std::ranges::size(wrapped.items) != count) {
+                        throw std::length_error("pulled array does not match the size of the destination");
+                    }
+                }
 
-                // return the target message so it can be chained
+                size_t i = msg.body.size() - count * sizeof(Item);
+                copy_network_order<sizeof(Item)>(reinterpret_cast<uint8_t*>(std::ranges::data(wrapped.items)), msg.body.data() + i, count);
+
+                msg.body.resize(i);
+                msg.header.size = msg.size();
                 return msg;
             }
         };
 
-        template <typename T>
+        // immutable, reference counted message - the header and body are built once and every
+        // connection that sends it just holds another reference, so a broadcast to n clients costs
+        // one allocation plus n refcount bumps instead of n copies of the body
+        template <typename T, size_t InlineBody = message_inline_body>
+        using shared_message = std::shared_ptr<const message<T, InlineBody>>;
+
+        template <typename T, size_t InlineBody>
+        shared_message<T, InlineBody> make_shared_message(message<T, InlineBody> msg) {
+            // a body that lives in an arena gets its control block from the same arena
+            if (std::pmr::memory_resource* resource = msg.body.resource()) {
+                return std::allocate_shared<message<T, InlineBody>>(std::pmr::polymorphic_allocator<message<T, InlineBody>>(resource), std::move(msg));
+            }
+            return std::make_shared<const message<T, InlineBody>>(std::move(msg));
+        }
+
+        // a shared copy of msg whose body (and control block) come from the same memory resource as msg's,
+        // where a plain copy would go to the heap. only for the thread that may allocate from that resource,
+        // for a message from CreateMessage that is the one running Update
+        template <typename T, size_t InlineBody>
+        shared_message<T, InlineBody> make_shared_copy(const message<T, InlineBody>& msg) {
+            message<T, InlineBody> copy;
+            copy.header = msg.header;
+            copy.body = decltype(copy.body)(msg.body, msg.body.resource());
+            return make_shared_message(std::move(copy));
+        }
+
+        // appends fields in the order they are meant to be read back with message_reader.
+        // plain data goes in exactly like operator<<, but strings and arrays are written
+        // with their length first (and arrays aligned to their element type) so the reader
+        // can walk the body front to back and hand out views instead of copies.
+        // the reader has to be told the same length_prefix the writer used
+        template <typename T, size_t InlineBody = message_inline_body>
+        class message_writer {
+        public:
+            explicit message_writer(message<T, InlineBody>& msg, length_prefix lengths = length_prefix::fixed) : msg(msg), lengths(lengths) {}
+
+            template <typename Datatype>
+            message_writer& write(const Datatype& data) {
+                static_assert(is_wire_type<Datatype>(), "data is too complex to be written into a message");
+                size_t i = msg.body.size();
+                msg.body.resize(i + wire_size_v<Datatype>);
+                wire_encode(msg.body.data() + i, data);
+                msg.header.size = uint32_t(msg.size());
+                return *this;
+            }
+
+            message_writer& write_string(std::string_view str) {
+                write_length(str.size());
+                append(str.data(), str.size());
+                return *this;
+            }
+
+            template <typename Datatype>
+            message_writer& write_span(std::span<const Datatype> items) {
+                static_assert(std::is_trivially_copyable_v<Datatype>, "data is too complex to be written into a message");
+                write_length(items.size());
+                pad_to(alignof(Datatype));
+                append(items.data(), items.size_bytes());
+                return *this;
+            }
+
+            template <typename Datatype>
+            message_writer& operator<<(const Datatype& data) {
+                if constexpr (std::is_convertible_v<const Datatype&, std::string_view>) {
+                    return write_string(data);
+                } else {
+                    return write(data);
+                }
+            }
+
+        private:
+            void write_length(size_t length) {
+                if (lengths == length_prefix::varint) {
+                    uint8_t bytes[max_varint_size];
+                    append(bytes, size_t(write_varint(bytes, length) - bytes));
+                } else {
+                    write(uint32_t(length));
+                }
+            }
+
+            void append(const void* src, size_t n) {
+                size_t i = msg.body.size();
+                msg.body.resize(i + n);
+                if (n > 0) {
+                    std::memcpy(msg.body.data() + i, src, n);
+                }
+                msg.header.size = uint32_t(msg.size());
+            }
+
+            void pad_to(size_t alignment) {
+                size_t padding = (alignment - msg.body.size() % alignment) % alignment;
+                msg.body.resize(msg.body.size() + padding);
+            }
+
+            message<T, InlineBody>& msg;
+            length_prefix lengths;
+        };
+
+        // forward read cursor over a message body. unlike operator>> it never modifies the message,
+        // so fields come back in the order they were written, the message can be read any number of
+        // times, and it can still be forwarded afterwards without a copy.
+        // strings and arrays must have been written with message_writer, and the returned views
+        // are only valid for as long as the message body is left alone
+        template <typename T, size_t InlineBody = message_inline_body>
+        class message_reader {
+        public:
+            explicit message_reader(const message<T, InlineBody>& msg, length_prefix lengths = length_prefix::fixed) :
+            bytes(msg.body.data()), length(msg.body.size()), lengths(lengths) {}
+
+            template <typename Datatype>
+            Datatype read() {
+                static_assert(is_wire_type<Datatype>(), "data is too complex to be read from a message");
+                Datatype data;
+                wire_decode(take(wire_size_v<Datatype>), data);
+                return data;
+            }
+
+            std::string_view read_string() {
+                size_t stringSize = read_length();
+                return {reinterpret_cast<const char*>(take(stringSize)), stringSize};
+            }
+
+            template <typename Datatype>
+            std::span<const Datatype> read_span() {
+                static_assert(std::is_trivially_copyable_v<Datatype>, "data is too complex to be read from a message");
+                size_t count = read_length();
+                skip((alignof(Datatype) - cursor % alignof(Datatype)) % alignof(Datatype));
+                // the count comes from the remote, checked before it is multiplied so it can't wrap
+                if (count > remaining() / sizeof(Datatype)) {
+                    throw std::out_of_range("message_reader: read past the end of the message body");
+                }
+                const uint8_t* start = take(count * sizeof(Datatype));
+                return {reinterpret_cast<const Datatype*>(start), count};
+            }
+
+            template <typename Datatype>
+            message_reader& operator>>(Datatype& data) {
+                if constexpr (std::is_same_v<Datatype, std::string_view>) {
+                    data = read_string();
+                } else {
+                    data = read<Datatype>();
+                }
+                return *this;
+            }
+
+            void skip(size_t n) { take(n); }
+            void rewind() { cursor = 0; }
+
+            size_t position() const { return cursor; }
+            size_t remaining() const { return length - cursor; }
+            bool empty() const { return cursor == length; }
+
+        private:
+            size_t read_length() {
+                if (lengths == length_prefix::varint) {
+                    uint64_t value = 0;
+                    size_t used = read_varint(bytes + cursor, remaining(), value);
+                    if (used == 0) {
+                        throw std::out_of_range("message_reader: read past the end of the message body");
+                    }
+                    cursor += used;
+                    return size_t(value);
+                }
+                return read<uint32_t>();
+            }
+
+            const uint8_t* take(size_t n) {
+                if (n > remaining()) {
+                    throw std::out_of_range("message_reader: read past the end of the message body");
+                }
+                const uint8_t* start = bytes + cursor;
+                cursor += n;
+                return start;
+            }
+
+            const uint8_t* bytes;
+            size_t length;
+            length_prefix lengths;
+            size_t cursor = 0;
+        };
+
+        // connections use the queued threading policy unless a server asks for another
+        template <typename T, typename Threading = queued_dispatch>
         class connection;
 
-        template <typename T>
+        // what an entry in the incoming queue is telling the owner
+        enum class connection_event : uint8_t {
+            message,     // msg arrived from remote
+            validated,   // remote finished the handshake, msg is empty
+            disconnect,  // remote has been closed, msg is empty
+            ready,       // remote has something waiting in its own inbound queue, msg is empty
+            chunk        // one piece of a stream arrived from remote, see read_chunk
+        };
+
+        template <typename T, typename Threading = queued_dispatch>
         struct owned_message {
-            std::shared_ptr<connection<T>> remote = nullptr;
+            std::shared_ptr<connection<T, Threading>> remote = nullptr;
             message<T> msg;
+            connection_event event = connection_event::message;
 
             // override for std::cout compatibility
-            friend std::ostream& operator<<(std::ostream& os, const owned_message<T>& msg) {
+            friend std::ostream& operator<<(std::ostream& os, const owned_message& msg) {
                 os << msg.msg;
                 return os;
             };
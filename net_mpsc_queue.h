@@ -0,0 +1,194 @@
+// Created by psdab on 5/2/2024.
+
+#ifndef BETTER_SERVER_NET_MPSC_QUEUE_H
+#define BETTER_SERVER_NET_MPSC_QUEUE_H
+#pragma once
+
+#include "net_common.h"
+
+#include <atomic>
+#include <new>
+
+namespace ps {
+    namespace net {
+        // bounded lock-free queue for many producer threads and a single consumer thread, used for
+        // messages coming in from the io threads. it offers the parts of tsqueue that make sense with one
+        // lock-free end: producers push_back, the consumer reads from the front. pushing never takes a lock,
+        // and the consumer only parks in wait() when the queue really is empty.
+        // when the ring is full producers block until the consumer pops something, which in turn stops the
+        // io thread reading and lets TCP push back on the sender
+        template <typename T>
+        class mpsc_queue {
+        public:
+            // capacity is rounded up to a power of two
+            explicit mpsc_queue(size_t capacity = 16384) {
+                size_t size = 2;
+                while (size < capacity) {
+                    size <<= 1;
+                }
+                mask = size - 1;
+                cells = std::make_unique<cell[]>(size);
+                for (size_t i = 0; i < size; i++) {
+                    cells[i].sequence.store(i, std::memory_order_relaxed);
+                }
+            }
+
+            mpsc_queue(const mpsc_queue<T>&) = delete;
+            mpsc_queue& operator=(const mpsc_queue<T>&) = delete;
+
+            virtual ~mpsc_queue() { clear(); }
+
+            // any thread - adds element after the last element in the queue
+            void push_back(const T& item) {
+                emplace(item);
+            }
+
+            void push_back(T&& item) {
+                emplace(std::move(item));
+            }
+
+            // consumer only - returns reference to first element in queue
+            const T& front() {
+                return *cells[dequeuePos.load(std::memory_order_relaxed) & mask].item();
+            }
+
+            // consumer only - returns true if there is nothing ready to pop
+            bool empty() {
+                size_t pos = dequeuePos.load(std::memory_order_relaxed);
+                return cells[pos & mask].sequence.load(std::memory_order_acquire) != pos + 1;
+            }
+
+            // returns the amount of elements in the queue, only a snapshot when producers are active
+            size_t count() {
+                size_t head = dequeuePos.load(std::memory_order_relaxed);
+                size_t tail = enqueuePos.load(std::memory_order_relaxed);
+                return tail > head ? tail - head : 0;
+            }
+
+            // consumer only - clears the whole queue
+            void clear() {
+                while (!empty()) {
+                    pop_front();
+                }
+            }
+
+            // consumer only - removes and returns first element in queue, the queue must not be empty
+            T pop_front() {
+                size_t pos = dequeuePos.load(std::memory_order_relaxed);
+                cell& c = cells[pos & mask];
+
+                T t = std::move(*c.item());
+                c.item()->~T();
+
+                // hand the cell back to producers for the next lap of the ring
+                c.sequence.store(pos + mask + 1, std::memory_order_release);
+                dequeuePos.store(pos + 1, std::memory_order_relaxed);
+
+                // wake producers that found the ring full once it is down to half, so they come back to a batch
+                // of free cells instead of one each, and only once per batch of sleepers. the fence pairs with
+                // the one in emplace, so either they see the cells freed so far or this sees them blocked
+                if (count() <= (mask + 1) / 2) {
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    if (blocked.load(std::memory_order_relaxed) > 0 && blocked.exchange(0, std::memory_order_acquire) > 0) {
+                        pops.fetch_add(1, std::memory_order_relaxed);
+                        pops.notify_all();
+                    }
+                }
+                return t;
+            }
+
+            // consumer only - pops up to max elements in one pass, calling f on each, and returns how many it took
+            template <typename F>
+            size_t drain(F&& f, size_t max = std::numeric_limits<size_t>::max()) {
+                size_t taken = 0;
+                while (taken < max && !empty()) {
+                    f(pop_front());
+                    taken++;
+                }
+                return taken;
+            }
+
+            // consumer only - block the thread until an item has been pushed in to the queue.
+            // the consumer announces it is about to sleep before checking one last time, and producers
+            // only notify when someone is asleep, so a push can never slip in between unnoticed
+            void wait() {
+                while (empty()) {
+                    uint32_t seen = pushes.load(std::memory_order_seq_cst);
+                    sleeping.store(true, std::memory_order_seq_cst);
+
+                    if (!empty()) {
+                        sleeping.store(false, std::memory_order_relaxed);
+                        return;
+                    }
+
+                    pushes.wait(seen, std::memory_order_seq_cst);
+                    sleeping.store(false, std::memory_order_relaxed);
+                }
+            }
+
+        protected:
+            struct cell {
+                std::atomic<size_t> sequence{0};
+                alignas(T) unsigned char storage[sizeof(T)];
+
+                T* item() { return std::launder(reinterpret_cast<T*>(storage)); }
+            };
+
+            template <typename U>
+            void emplace(U&& item) {
+                size_t pos = enqueuePos.load(std::memory_order_relaxed);
+                cell* c = nullptr;
+
+                while (true) {
+                    c = &cells[pos & mask];
+                    size_t sequence = c->sequence.load(std::memory_order_acquire);
+                    intptr_t diff = intptr_t(sequence) - intptr_t(pos);
+
+                    if (diff == 0) {
+                        // the cell is free on this lap, try to claim it
+                        if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                            break;
+                        }
+                    } else if (diff < 0) {
+                        // the ring is full, sleep until the consumer makes room. seen is read before announcing
+                        // this producer, so the wake that takes the announcement always changes pops from it
+                        uint32_t seen = pops.load(std::memory_order_relaxed);
+                        blocked.fetch_add(1, std::memory_order_release);
+                        std::atomic_thread_fence(std::memory_order_seq_cst);
+                        if (intptr_t(c->sequence.load(std::memory_order_relaxed)) - intptr_t(pos) < 0) {
+                            pops.wait(seen, std::memory_order_relaxed);
+                        }
+                        pos = enqueuePos.load(std::memory_order_relaxed);
+                    } else {
+                        // another producer got this cell first
+                        pos = enqueuePos.load(std::memory_order_relaxed);
+                    }
+                }
+
+                new (c->storage) T(std::forward<U>(item));
+                c->sequence.store(pos + 1, std::memory_order_release);
+
+                pushes.fetch_add(1, std::memory_order_seq_cst);
+                if (sleeping.load(std::memory_order_seq_cst)) {
+                    pushes.notify_one();
+                }
+            }
+
+            std::unique_ptr<cell[]> cells;
+            size_t mask = 0;
+
+            // producers and the consumer work on different ends, keep them off each other's cache lines
+            alignas(64) std::atomic<size_t> enqueuePos{0};
+            alignas(64) std::atomic<size_t> dequeuePos{0};
+
+            alignas(64) std::atomic<uint32_t> pushes{0};
+            std::atomic<bool> sleeping{false};
+
+            // producers that found the ring full since the consumer last woke any, and what they wait on
+            alignas(64) std::atomic<uint32_t> pops{0};
+            std::atomic<uint32_t> blocked{0};
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,121 @@
+// Created by psdab on 5/2/2024.
+
+#ifndef BETTER_SERVER_NET_POOL_H
+#define BETTER_SERVER_NET_POOL_H
+#pragma once
+
+#include "net_common.h"
+
+#include <array>
+#include <atomic>
+#include <memory_resource>
+
+namespace ps {
+    namespace net {
+        // counters for a buffer_pool, readable from any thread
+        struct pool_stats {
+            std::atomic<uint64_t> reused{0};     // allocations served from a free list
+            std::atomic<uint64_t> allocated{0};  // allocations that had to go to the heap
+            std::atomic<uint64_t> released{0};   // frees that went back to the heap because the pool was full
+            std::atomic<size_t> retained{0};     // bytes currently sitting in the free lists
+        };
+
+        // size classed free lists for received message bodies. blocks are rounded up to a power of two
+        // and kept when freed, up to a cap on the total bytes retained, so in steady state receiving does
+        // no malloc/free. the io thread allocates and whichever thread drops the message frees, so it is locked,
+        // unless everything happens on one thread and Mutex is a null_mutex
+        template <typename Mutex = std::mutex>
+        class basic_buffer_pool : public std::pmr::memory_resource {
+        public:
+            explicit basic_buffer_pool(size_t maxRetained = 16 * 1024 * 1024) : maxRetained(maxRetained) {}
+
+            basic_buffer_pool(const basic_buffer_pool&) = delete;
+            basic_buffer_pool& operator=(const basic_buffer_pool&) = delete;
+
+            ~basic_buffer_pool() override {
+                for (auto& list : freeLists) {
+                    for (void* block : list) {
+                        ::operator delete(block);
+                    }
+                }
+            }
+
+            // change how many bytes the free lists may hold on to, anything over it is released on free
+            void SetRetainLimit(size_t bytes) {
+                std::scoped_lock lock(muxPool);
+                maxRetained = bytes;
+            }
+
+            const pool_stats& Stats() const {
+                return stats;
+            }
+
+        private:
+            // classes run from 128 bytes (anything smaller is stored inline in the message) up to 1 MB
+            static constexpr size_t MinClassShift = 7;
+            static constexpr size_t ClassCount = 14;
+
+            static size_t class_of(size_t bytes) {
+                size_t index = 0;
+                while ((size_t(1) << (MinClassShift + index)) < bytes) {
+                    index++;
+                }
+                return index;
+            }
+
+            void* do_allocate(size_t bytes, size_t alignment) override {
+                size_t index = class_of(bytes);
+                if (index >= ClassCount || alignment > alignof(std::max_align_t)) {
+                    stats.allocated.fetch_add(1, std::memory_order_relaxed);
+                    return ::operator new(bytes);
+                }
+
+                size_t classSize = size_t(1) << (MinClassShift + index);
+                {
+                    std::scoped_lock lock(muxPool);
+                    auto& list = freeLists[index];
+                    if (!list.empty()) {
+                        void* block = list.back();
+                        list.pop_back();
+                        stats.retained.fetch_sub(classSize, std::memory_order_relaxed);
+                        stats.reused.fetch_add(1, std::memory_order_relaxed);
+                        return block;
+                    }
+                }
+
+                stats.allocated.fetch_add(1, std::memory_order_relaxed);
+                return ::operator new(classSize);
+            }
+
+            void do_deallocate(void* block, size_t bytes, size_t alignment) override {
+                size_t index = class_of(bytes);
+                if (index < ClassCount && alignment <= alignof(std::max_align_t)) {
+                    size_t classSize = size_t(1) << (MinClassShift + index);
+
+                    std::scoped_lock lock(muxPool);
+                    if (stats.retained.load(std::memory_order_relaxed) + classSize <= maxRetained) {
+                        freeLists[index].push_back(block);
+                        stats.retained.fetch_add(classSize, std::memory_order_relaxed);
+                        return;
+                    }
+                }
+
+                stats.released.fetch_add(1, std::memory_order_relaxed);
+                ::operator delete(block);
+            }
+
+            bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+                return this == &other;
+            }
+
+            Mutex muxPool;
+            std::array<std::vector<void*>, ClassCount> freeLists;
+            size_t maxRetained;
+            pool_stats stats;
+        };
+
+        using buffer_pool = basic_buffer_pool<>;
+    }
+}
+
+#endif
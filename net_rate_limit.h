@@ -0,0 +1,71 @@
+// Created by psdab on 5/2/2024.
+
+#ifndef BETTER_SERVER_NET_RATE_LIMIT_H
+#define BETTER_SERVER_NET_RATE_LIMIT_H
+#pragma once
+
+#include "net_common.h"
+
+namespace ps {
+    namespace net {
+        // what a server side connection does with a frame that is over its client's rate limit
+        enum class rate_limit_policy : uint8_t {
+            throttle,   // stop reading until the buckets have refilled, TCP pushes back on the client
+            drop,       // throw the frame away without allocating or copying it
+            disconnect  // close the connection
+        };
+
+        // how fast a client may send, zero turns a limit off. each limit is a token bucket that holds
+        // up to a burst (one second's worth when left at zero) and refills at its rate.
+        // a frame takes one message token and a byte token for each of its bytes
+        struct rate_limit {
+            double messages_per_sec = 0;
+            double bytes_per_sec = 0;
+            double burst_messages = 0;
+            double burst_bytes = 0;
+            rate_limit_policy policy = rate_limit_policy::throttle;
+        };
+
+        // a single token bucket, only ever touched by its connection's io thread
+        class token_bucket {
+        public:
+            void reset(double rate, double burst) {
+                this->rate = rate;
+                this->burst = burst > 0 ? burst : rate;
+                tokens = this->burst;
+            }
+
+            bool enabled() const {
+                return rate > 0;
+            }
+
+            void refill(double seconds) {
+                tokens = std::min(burst, tokens + seconds * rate);
+            }
+
+            // a cost bigger than the whole bucket goes through once the bucket is full, leaving it in debt,
+            // so a limit smaller than one frame slows the client down instead of stopping it for good
+            bool ready(double cost) const {
+                return !enabled() || tokens >= std::min(cost, burst);
+            }
+
+            void take(double cost) {
+                if (enabled()) {
+                    tokens -= cost;
+                }
+            }
+
+            // seconds until ready(cost) would be true
+            double wait(double cost) const {
+                return ready(cost) ? 0.0 : (std::min(cost, burst) - tokens) / rate;
+            }
+
+        private:
+            double rate = 0;
+            double burst = 0;
+            double tokens = 0;
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,341 @@
+// Created by psdab on 5/2/2024.
+
+#ifndef BETTER_SERVER_NET_SERIALIZE_H
+#define BETTER_SERVER_NET_SERIALIZE_H
+#pragma once
+
+#include "net_common.h"
+
+#include <array>
+#include <cstring>
+#include <tuple>
+
+// compile-time layout of structs pushed into messages.
+//
+// a struct is encoded field by field with no padding, its full encoded size is known at compile time
+// (wire_size_v), so a message can be grown once and the whole struct copied in a single pass.
+// the fields are found one of two ways:
+//   - a declared field list:
+//         template <> struct ps::net::wire_fields<Position> : ps::net::fields<&Position::x, &Position::y> {};
+//   - otherwise, plain aggregates (up to 12 members, no base classes, std::array instead of c arrays)
+//     are split into their members automatically with structured bindings.
+// runs of elements (std::array, c arrays, spans) go through wire_encode_n/wire_decode_n, which
+// copy the whole block with one memcpy whenever the element has no padding.
+// every field must itself be an arithmetic type, an enum, a std::array or another wire struct -
+// pointers are rejected at compile time, and so is any other class (std::string_view, std::span, a
+// handle wrapping a pointer...) unless it declares its wire_fields or opts in with wire_opaque.
+
+namespace ps {
+    namespace net {
+        template <auto... Members>
+        struct fields;
+
+        // specialise this to declare which members of a struct go on the wire, and in what order
+        template <typename S>
+        struct wire_fields {
+            static constexpr bool declared = false;
+        };
+
+        // specialise this to true to copy a class with no pointers and no padding as one opaque block
+        template <typename S>
+        struct wire_opaque : std::false_type {};
+
+        namespace detail {
+            constexpr size_t max_aggregate_fields = 12;
+
+            template <typename S>
+            struct is_std_array : std::false_type {};
+
+            template <typename U, size_t N>
+            struct is_std_array<std::array<U, N>> : std::true_type {};
+
+            template <typename C, typename U>
+            U member_type_of(U C::*);
+
+            template <auto Member>
+            using member_type_t = decltype(member_type_of(Member));
+
+            // converts to anything, used to count how many initialisers an aggregate accepts
+            struct any_field {
+                template <typename U>
+                operator U() const;
+            };
+
+            template <typename S, size_t... I>
+            constexpr bool brace_constructible(std::index_sequence<I...>) {
+                return requires { S{((void)I, any_field{})...}; };
+            }
+
+            template <typename S, size_t N = max_aggregate_fields>
+            constexpr size_t aggregate_field_count() {
+                if constexpr (N == 0) {
+                    return 0;
+                } else if constexpr (brace_constructible<S>(std::make_index_sequence<N>{})) {
+                    return N;
+                } else {
+                    return aggregate_field_count<S, N - 1>();
+                }
+            }
+
+            template <typename S>
+            constexpr bool is_splittable_aggregate() {
+                if constexpr (std::is_class_v<S> && std::is_aggregate_v<S> && !is_std_array<S>::value) {
+                    return aggregate_field_count<S>() > 0;
+                } else {
+                    return false;
+                }
+            }
+
+            // calls f on every member of an aggregate, in declaration order
+            template <typename S, typename F>
+            constexpr void visit_fields(S& s, F&& fn) {
+                constexpr size_t count = aggregate_field_count<std::remove_cv_t<S>>();
+                if constexpr (count == 1) {
+                    auto& [a] = s;
+                    (fn(a));
+                } else if constexpr (count == 2) {
+                    auto& [a, b] = s;
+                    (fn(a), fn(b));
+                } else if constexpr (count == 3) {
+                    auto& [a, b, c] = s;
+                    (fn(a), fn(b), fn(c));
+                } else if constexpr (count == 4) {
+                    auto& [a, b, c, d] = s;
+                    (fn(a), fn(b), fn(c), fn(d));
+                } else if constexpr (count == 5) {
+                    auto& [a, b, c, d, e] = s;
+                    (fn(a), fn(b), fn(c), fn(d), fn(e));
+                } else if constexpr (count == 6) {
+                    auto& [a, b, c, d, e, f] = s;
+                    (fn(a), fn(b), fn(c), fn(d), fn(e), fn(f));
+                } else if constexpr (count == 7) {
+                    auto& [a, b, c, d, e, f, g] = s;
+                    (fn(a), fn(b), fn(c), fn(d), fn(e), fn(f), fn(g));
+                } else if constexpr (count == 8) {
+                    auto& [a, b, c, d, e, f, g, h] = s;
+                    (fn(a), fn(b), fn(c), fn(d), fn(e), fn(f), fn(g), fn(h));
+                } else if constexpr (count == 9) {
+                    auto& [a, b, c, d, e, f, g, h, i] = s;
+                    (fn(a), fn(b), fn(c), fn(d), fn(e), fn(f), fn(g), fn(h), fn(i));
+                } else if constexpr (count == 10) {
+                    auto& [a, b, c, d, e, f, g, h, i, j] = s;
+                    (fn(a), fn(b), fn(c), fn(d), fn(e), fn(f), fn(g), fn(h), fn(i), fn(j));
+                } else if constexpr (count == 11) {
+                    auto& [a, b, c, d, e, f, g, h, i, j, k] = s;
+                    (fn(a), fn(b), fn(c), fn(d), fn(e), fn(f), fn(g), fn(h), fn(i), fn(j), fn(k));
+                } else if constexpr (count == 12) {
+                    auto& [a, b, c, d, e, f, g, h, i, j, k, l] = s;
+                    (fn(a), fn(b), fn(c), fn(d), fn(e), fn(f), fn(g), fn(h), fn(i), fn(j), fn(k), fn(l));
+                }
+            }
+
+            // only used in unevaluated context to name the member types of an aggregate
+            template <typename S>
+            auto field_types(S& s) {
+                constexpr size_t count = aggregate_field_count<S>();
+                if constexpr (count == 1) {
+                    auto& [a] = s;
+                    return static_cast<std::tuple<std::remove_cvref_t<decltype(a)>>*>(nullptr);
+                } else if constexpr (count == 2) {
+                    auto& [a, b] = s;
+                    return static_cast<std::tuple<std::remove_cvref_t<decltype(a)>, std::remove_cvref_t<decltype(b)>>*>(nullptr);
+                } else if constexpr (count == 3) {
+                    auto& [a, b, c] = s;
+                    return static_cast<std::tuple<std::remove_cvref_t<decltype(a)>, std::remove_cvref_t<decltype(b)>, std::remove_cvref_t<decltype(c)>>*>(nullptr);
+                } else if constexpr (count == 4) {
+                    auto& [a, b, c, d] = s;
+                    return static_cast<std::tuple<std::remove_cvref_t<decltype(a)>, std::remove_cvref_t<decltype(b)>, std::remove_cvref_t<decltype(c)>, std::remove_cvref_t<decltype(d)>>*>(nullptr);
+                } else if constexpr (count == 5) {
+                    auto& [a, b, c, d, e] = s;
+                    return static_cast<std::tuple<std::remove_cvref_t<decltype(a)>, std::remove_cvref_t<decltype(b)>, std::remove_cvref_t<decltype(c)>, std::remove_cvref_t<decltype(d)>, std::remove_cvref_t<decltype(e)>>*>(nullptr);
+                } else if constexpr (count == 6) {
+                    auto& [a, b, c, d, e, f] = s;
+                    return static_cast<std::tuple<std::remove_cvref_t<decltype(a)>, std::remove_cvref_t<decltype(b)>, std::remove_cvref_t<decltype(c)>, std::remove_cvref_t<decltype(d)>, std::remove_cvref_t<decltype(e)>, std::remove_cvref_t<decltype(f)>>*>(nullptr);
+                } else if constexpr (count == 7) {
+                    auto& [a, b, c, d, e, f, g] = s;
+                    return static_cast<std::tuple<std::remove_cvref_t<decltype(a)>, std::remove_cvref_t<decltype(b)>, std::remove_cvref_t<decltype(c)>, std::remove_cvref_t<decltype(d)>, std::remove_cvref_t<decltype(e)>, std::remove_cvref_t<decltype(f)>, std::remove_cvref_t<decltype(g)>>*>(nullptr);
+                } else if constexpr (count == 8) {
+                    auto& [a, b, c, d, e, f, g, h] = s;
+                    return static_cast<std::tuple<std::remove_cvref_t<decltype(a)>, std::remove_cvref_t<decltype(b)>, std::remove_cvref_t<decltype(c)>, std::remove_cvref_t<decltype(d)>, std::remove_cvref_t<decltype(e)>, std::remove_cvref_t<decltype(f)>, std::remove_cvref_t<decltype(g)>, std::remove_cvref_t<decltype(h)>>*>(nullptr);
+                } else if constexpr (count == 9) {
+                    auto& [a, b, c, d, e, f, g, h, i] = s;
+                    return static_cast<std::tuple<std::remove_cvref_t<decltype(a)>, std::remove_cvref_t<decltype(b)>, std::remove_cvref_t<decltype(c)>, std::remove_cvref_t<decltype(d)>, std::remove_cvref_t<decltype(e)>, std::remove_cvref_t<decltype(f)>, std::remove_cvref_t<decltype(g)>, std::remove_cvref_t<decltype(h)>, std::remove_cvref_t<decltype(i)>>*>(nullptr);
+                } else if constexpr (count == 10) {
+                    auto& [a, b, c, d, e, f, g, h, i, j] = s;
+                    return static_cast<std::tuple<std::remove_cvref_t<decltype(a)>, std::remove_cvref_t<decltype(b)>, std::remove_cvref_t<decltype(c)>, std::remove_cvref_t<decltype(d)>, std::remove_cvref_t<decltype(e)>, std::remove_cvref_t<decltype(f)>, std::remove_cvref_t<decltype(g)>, std::remove_cvref_t<decltype(h)>, std::remove_cvref_t<decltype(i)>, std::remove_cvref_t<decltype(j)>>*>(nullptr);
+                } else if constexpr (count == 11) {
+                    auto& [a, b, c, d, e, f, g, h, i, j, k] = s;
+                    return static_cast<std::tuple<std::remove_cvref_t<decltype(a)>, std::remove_cvref_t<decltype(b)>, std::remove_cvref_t<decltype(c)>, std::remove_cvref_t<decltype(d)>, std::remove_cvref_t<decltype(e)>, std::remove_cvref_t<decltype(f)>, std::remove_cvref_t<decltype(g)>, std::remove_cvref_t<decltype(h)>, std::remove_cvref_t<decltype(i)>, std::remove_cvref_t<decltype(j)>, std::remove_cvref_t<decltype(k)>>*>(nullptr);
+                } else if constexpr (count == 12) {
+                    auto& [a, b, c, d, e, f, g, h, i, j, k, l] = s;
+                    return static_cast<std::tuple<std::remove_cvref_t<decltype(a)>, std::remove_cvref_t<decltype(b)>, std::remove_cvref_t<decltype(c)>, std::remove_cvref_t<decltype(d)>, std::remove_cvref_t<decltype(e)>, std::remove_cvref_t<decltype(f)>, std::remove_cvref_t<decltype(g)>, std::remove_cvref_t<decltype(h)>, std::remove_cvref_t<decltype(i)>, std::remove_cvref_t<decltype(j)>, std::remove_cvref_t<decltype(k)>, std::remove_cvref_t<decltype(l)>>*>(nullptr);
+                }
+            }
+
+            template <typename S>
+            using field_tuple_t = std::remove_pointer_t<decltype(field_types(std::declval<S&>()))>;
+        }
+
+        // true when S can be encoded with the compile-time layout
+        template <typename S>
+        constexpr bool is_wire_type();
+
+        // number of bytes S occupies on the wire
+        template <typename S>
+        constexpr size_t wire_size();
+
+        template <typename S>
+        uint8_t* wire_encode(uint8_t* out, const S& s);
+
+        template <typename S>
+        const uint8_t* wire_decode(const uint8_t* in, S& s);
+
+        template <auto... Members>
+        struct fields {
+            static constexpr bool declared = true;
+
+            static constexpr bool valid() {
+                return (is_wire_type<detail::member_type_t<Members>>() && ...);
+            }
+
+            static constexpr size_t size() {
+                return (wire_size<detail::member_type_t<Members>>() + ...);
+            }
+
+            template <typename S>
+            static uint8_t* encode(uint8_t* out, const S& s) {
+                ((out = wire_encode(out, s.*Members)), ...);
+                return out;
+            }
+
+            template <typename S>
+            static const uint8_t* decode(const uint8_t* in, S& s) {
+                ((in = wire_decode(in, s.*Members)), ...);
+                return in;
+            }
+        };
+
+        template <typename S>
+        constexpr bool is_wire_type() {
+            if constexpr (std::is_pointer_v<S> || std::is_member_pointer_v<S> || std::is_null_pointer_v<S> || std::is_reference_v<S>) {
+                return false;
+            } else if constexpr (std::is_arithmetic_v<S> || std::is_enum_v<S>) {
+                return true;
+            } else if constexpr (detail::is_std_array<S>::value) {
+                return is_wire_type<typename S::value_type>();
+            } else if constexpr (std::is_bounded_array_v<S>) {
+                return is_wire_type<std::remove_extent_t<S>>();
+            } else if constexpr (wire_fields<S>::declared) {
+                return wire_fields<S>::valid();
+            } else if constexpr (detail::is_splittable_aggregate<S>()) {
+                return []<typename... F>(std::tuple<F...>*) {
+                    return (is_wire_type<F>() && ...);
+                }(static_cast<detail::field_tuple_t<S>*>(nullptr));
+            } else if constexpr (wire_opaque<S>::value) {
+                // copied as one block, which is only safe if every byte of it is meaningful (no padding)
+                return std::is_trivially_copyable_v<S> && std::has_unique_object_representations_v<S>;
+            } else {
+                // a class with no visible fields may well be holding a pointer, so it has to say what it carries
+                return false;
+            }
+        }
+
+        template <typename S>
+        constexpr size_t wire_size() {
+            if constexpr (detail::is_std_array<S>::value) {
+                return std::tuple_size_v<S> * wire_size<typename S::value_type>();
+            } else if constexpr (std::is_bounded_array_v<S>) {
+                return std::extent_v<S> * wire_size<std::remove_extent_t<S>>();
+            } else if constexpr (std::is_arithmetic_v<S> || std::is_enum_v<S>) {
+                return sizeof(S);
+            } else if constexpr (wire_fields<S>::declared) {
+                return wire_fields<S>::size();
+            } else if constexpr (detail::is_splittable_aggregate<S>()) {
+                return []<typename... F>(std::tuple<F...>*) {
+                    return (wire_size<F>() + ...);
+                }(static_cast<detail::field_tuple_t<S>*>(nullptr));
+            } else {
+                return sizeof(S);
+            }
+        }
+
+        template <typename S>
+        constexpr size_t wire_size_v = wire_size<S>();
+
+        template <typename S>
+        uint8_t* wire_encode(uint8_t* out, const S& s) {
+            static_assert(is_wire_type<S>(), "type has pointers or padding - declare its wire_fields or push its members individually");
+
+            if constexpr ((detail::is_std_array<S>::value || std::is_bounded_array_v<S>) && wire_size<S>() != sizeof(S)) {
+                for (const auto& item : s) {
+                    out = wire_encode(out, item);
+                }
+                return out;
+            } else if constexpr (wire_fields<S>::declared) {
+                return wire_fields<S>::encode(out, s);
+            } else if constexpr (detail::is_splittable_aggregate<S>() && wire_size<S>() != sizeof(S)) {
+                detail::visit_fields(s, [&out](const auto& field) { out = wire_encode(out, field); });
+                return out;
+            } else {
+                // no padding anywhere, so the in-memory layout already is the wire layout
+                std::memcpy(out, &s, sizeof(S));
+                return out + sizeof(S);
+            }
+        }
+
+        template <typename S>
+        const uint8_t* wire_decode(const uint8_t* in, S& s) {
+            static_assert(is_wire_type<S>(), "type has pointers or padding - declare its wire_fields or pull its members individually");
+
+            if constexpr ((detail::is_std_array<S>::value || std::is_bounded_array_v<S>) && wire_size<S>() != sizeof(S)) {
+                for (auto& item : s) {
+                    in = wire_decode(in, item);
+                }
+                return in;
+            } else if constexpr (wire_fields<S>::declared) {
+                return wire_fields<S>::decode(in, s);
+            } else if constexpr (detail::is_splittable_aggregate<S>() && wire_size<S>() != sizeof(S)) {
+                detail::visit_fields(s, [&in](auto& field) { in = wire_decode(in, field); });
+                return in;
+            } else {
+                std::memcpy(&s, in, sizeof(S));
+                return in + sizeof(S);
+            }
+        }
+
+        // encode count consecutive items, as one block copy when their layout is already the wire layout
+        template <typename S>
+        uint8_t* wire_encode_n(uint8_t* out, const S* items, size_t count) {
+            if constexpr (wire_size<S>() == sizeof(S) && std::is_trivially_copyable_v<S>) {
+                static_assert(is_wire_type<S>(), "type has pointers or padding - declare its wire_fields or push its members individually");
+                if (count > 0) {
+                    std::memcpy(out, items, count * sizeof(S));
+                }
+                return out + count * sizeof(S);
+            } else {
+                for (size_t i = 0; i < count; i++) {
+                    out = wire_encode(out, items[i]);
+                }
+                return out;
+            }
+        }
+
+        template <typename S>
+        const uint8_t* wire_decode_n(const uint8_t* in, S* items, size_t count) {
+            if constexpr (wire_size<S>() == sizeof(S) && std::is_trivially_copyable_v<S>) {
+                static_assert(is_wire_type<S>(), "type has pointers or padding - declare its wire_fields or pull its members individually");
+                if (count > 0) {
+                    std::memcpy(items, in, count * sizeof(S));
+                }
+                return in + count * sizeof(S);
+            } else {
+                for (size_t i = 0; i < count; i++) {
+                    in = wire_decode(in, items[i]);
+                }
+                return in;
+            }
+        }
+    }
+}
+
+#endif
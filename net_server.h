@@ -6,16 +6,57 @@
 
 #include "net_common.h"
 #include "net_tsqueue.h"
+#include "net_mpsc_queue.h"
 #include "net_message.h"
 #include "net_connection.h"
+#include "net_timer_wheel.h"
+#include "net_slot_map.h"
+#include "net_io_pool.h"
+#include "net_dispatch.h"
+#include "net_threading.h"
+#include "net_arena.h"
+#include "net_pool.h"
+
+#include <span>
 
 namespace ps {
     namespace net {
-        template <typename T>
+        // how a server listens for connections
+        enum class accept_mode : uint8_t {
+            single,     // one acceptor on the first io thread, handing sockets out to the others
+            reuse_port  // an SO_REUSEPORT acceptor on every io thread, the kernel spreads connections
+                        // between them. falls back to single where SO_REUSEPORT doesn't exist
+        };
+
+        // what a connection's share of each Update is measured in
+        enum class inbound_quantum : uint8_t {
+            messages,  // every message costs one
+            bytes      // every message costs its header and body size
+        };
+
+        // counters for the acceptors, readable from any thread
+        struct accept_stats {
+            std::atomic<uint64_t> accepted{0};  // connections let through by OnClientConnect
+            std::atomic<uint64_t> denied{0};    // connections refused by OnClientConnect
+            std::atomic<uint64_t> wakeups{0};   // accept completions, each takes as many waiting connections as it can
+            std::atomic<uint64_t> errors{0};    // failed accepts
+            std::atomic<uint64_t> validated{0}; // accepted connections that went on to finish the handshake
+        };
+
+#ifdef SO_REUSEPORT
+        using reuse_port_option = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+
+        // Threading picks where handlers run, see net_threading.h. the default queues messages for Update
+        template <typename T, typename Threading>
         class server_interface {
         public:
-            server_interface(uint16_t port) : asio_acceptor(context, asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port)) {
+            using connection_type = connection<T, Threading>;
 
+            // threads is how many io threads (each with its own context) connections are spread over,
+            // always one with inline handlers. the port is bound by Start
+            server_interface(uint16_t port, size_t threads = 1) : pool(Threading::inline_handlers ? 1 : threads), port(port) {
+                options.body_pool = &inbound_pool;
             }
 
             virtual ~server_interface() {
@@ -24,10 +65,24 @@ namespace ps {
 
             bool Start() {
                 try {
+                    OpenAcceptors();
                     // add work to the context before telling it to run in another thread
-                    WaitForClientConnection();
-                    // run is needed to start running all work that we primed
-                    context_thread = std::thread([this]() { context.run(); });
+                    for (size_t i = 0; i < acceptors.size(); i++) {
+                        WaitForClientConnection(i);
+                    }
+                    if constexpr (Threading::inline_handlers) {
+                        // messages are built on the io thread, so that is where their arena moves on
+                        ScheduleArenaTick();
+                    }
+                    // run every io thread, each with a timing wheel driving its connections' deadlines
+                    pool.Start();
+                    if constexpr (!Threading::inline_handlers) {
+                        if (dispatchWorkers > 0) {
+                            dispatcher.Start(dispatchWorkers, [this](owned_message<T>& msg) {
+                                Handle(msg.remote, msg.msg, msg.event);
+                            }, dispatchQuantum);
+                        }
+                    }
                 } catch (std::exception& e) {
                     // something prohibited the server from listening
                     std::cerr << "[SERVER] exception: " << e.what() << "\n";
@@ -38,136 +93,665 @@ namespace ps {
                 return true;
             }
             bool Stop() {
-                // request the context to close
-                context.stop();
-
-                // tidy up the context thread
-                if (context_thread.joinable()) { context_thread.join(); }
+                // request every context to close and tidy up their threads,
+                // then let the dispatch workers finish what they were already given
+                pool.Stop();
+                if constexpr (!Threading::inline_handlers) {
+                    dispatcher.Stop();
+                }
                 std::cout << "[SERVER] stopped!\n";
+                return true;
             }
 
-            // async - instruct asio to wait for connection
-            void WaitForClientConnection() {
-                asio_acceptor.async_accept([this](std::error_code ec, asio::ip::tcp::socket socket) {
-                    if (!ec) {
-                        std::cout << "[SERVER] new connection: " << socket.remote_endpoint() << "\n";
-
-                        std::shared_ptr<connection<T>> newconn =
-                                std::make_shared<connection<T>>(connection<T>::owner::server,
-                                        context, std::move(socket), messages_in);
+            // async - instruct asio to wait for connection on one of the acceptors
+            void WaitForClientConnection(size_t index = 0) {
+                asio::ip::tcp::acceptor& acceptor = *acceptors[index];
 
-                        // give the user a chance to deny connection
-                        if (OnClientConnect(newconn)) {
-                            // connection allowed, so add to container of new connections
-                            deqConnections.push_back(std::move(newconn));
-
-                            deqConnections.back()->ConnectToClient(this, id_counter++);
-
-                            std::cout << "[" << deqConnections.back()->GetID() << "] connection approved\n";
-                        } else {
-                            std::cout << "[-----] connection denied\n";
+                // the socket is opened straight on the context of the shard it will live on
+                io_shard& shard = ShardFor(index);
+                acceptor.async_accept(shard.context, [this, index, &acceptor, &shard](std::error_code ec, asio::ip::tcp::socket socket) {
+                    if (!ec) {
+                        acceptStats.wakeups.fetch_add(1, std::memory_order_relaxed);
+                        AcceptConnection(shard, std::move(socket));
+
+                        // during a burst more connections are usually waiting behind the one that woke us,
+                        // take them straight from the (non-blocking) acceptor instead of going back to the reactor
+                        for (size_t i = 1; i < acceptBatch; i++) {
+                            io_shard& next = ShardFor(index);
+                            asio::error_code error;
+                            asio::ip::tcp::socket more(acceptor.accept(next.context, error));
+                            if (error) {
+                                break;
+                            }
+                            AcceptConnection(next, std::move(more));
                         }
                     } else {
                         // error has occured during acceptance
+                        acceptStats.errors.fetch_add(1, std::memory_order_relaxed);
                         std::cout << "[SERVER] new connection error: " << ec.message() << "\n";
                     }
 
                     // prime the asio context with more work - waiting for another connection
-                    WaitForClientConnection();
+                    WaitForClientConnection(index);
                 });
             }
 
-            // send a message to a specific client
-            void MessageClient(std::shared_ptr<connection<T>> client, const message<T>& msg) {
-                if (client && client->IsConnected()) {
-                    client->Send(msg);
+            // send a message to a specific client on one of its outbound lanes, returns true if it was queued
+            bool MessageClient(std::shared_ptr<connection_type> client, const message<T>& msg, size_t lane = 0) {
+                return MessageClient(std::move(client), make_shared_copy(msg), lane);
+            }
+
+            bool MessageClient(std::shared_ptr<connection_type> client, shared_message<T> msg, size_t lane = 0) {
+                // a client that has gone is refused here, it was (or is about to be) removed by its disconnect event
+                std::shared_lock lock(muxConnections);
+                if (client && connections.contains(client->GetID())) {
+                    return client->Send(std::move(msg), lane);
+                }
+                return false;
+            }
+
+            // send a message to the client with this id. an id whose client has gone is refused,
+            // even if its slot has since been given to someone else
+            bool MessageClient(uint32_t id, const message<T>& msg, size_t lane = 0) {
+                return MessageClient(id, make_shared_copy(msg), lane);
+            }
+
+            bool MessageClient(uint32_t id, shared_message<T> msg, size_t lane = 0) {
+                std::shared_lock lock(muxConnections);
+                if (auto* client = connections.find(id)) {
+                    return (*client)->Send(std::move(msg), lane);
+                }
+                return false;
+            }
+
+            // the live client with this id, nullptr if there isn't one
+            std::shared_ptr<connection_type> GetClient(uint32_t id) {
+                std::shared_lock lock(muxConnections);
+                auto* client = connections.find(id);
+                return client ? *client : nullptr;
+            }
+
+            size_t ClientCount() const {
+                std::shared_lock lock(muxConnections);
+                return connections.size();
+            }
+
+            // send a message to all clients, the message is copied once and then shared between every connection.
+            // returns how many clients it was queued for
+            size_t MessageAllClients(const message<T>& msg, std::shared_ptr<connection_type> ignore_client = nullptr, size_t lane = 0) {
+                return MessageAllClients(make_shared_copy(msg), std::move(ignore_client), lane);
+            }
+
+            size_t MessageAllClients(shared_message<T> msg, std::shared_ptr<connection_type> ignore_client = nullptr, size_t lane = 0) {
+                if (msg->body.size() >= chunk_frame_flag) {
+                    return 0;
+                }
+
+                size_t queued = 0;
+                std::shared_lock lock(muxConnections);
+
+                // only live validated clients are in the list, dead ones are taken out as soon as
+                // their disconnect event is handled, so there is nothing to check or clean up here
+                if constexpr (Threading::inline_handlers) {
+                    for (auto& client : connections) {
+                        if (client != ignore_client && client->Send(msg, lane)) { queued++; }
+                    }
                 } else {
-                    OnClientDisconnect(client);
-                    client.reset();
-                    deqConnections.erase(
-                            std::remove(deqConnections.begin(), deqConnections.end(), client),
-                            deqConnections.end());
+                    // each client is checked and counted here like any Send, but each io thread gets one post
+                    // carrying its share of the recipients rather than one post per client
+                    std::vector<broadcast_batch> batches;
+                    batches.reserve(pool.size());
+                    for (auto& client : connections) {
+                        if (client == ignore_client || !client->AdmitOutgoing(msg)) {
+                            continue;
+                        }
+
+                        auto batch = std::find_if(batches.begin(), batches.end(), [&](const broadcast_batch& b) { return b.shard == client->shard; });
+                        if (batch == batches.end()) {
+                            batch = batches.insert(batches.end(), {client->shard, {}});
+                            batch->recipients.reserve(client->shard->connections.load(std::memory_order_relaxed));
+                        }
+                        batch->recipients.push_back({client, client->CountOutgoing(*msg, lane)});
+                        queued++;
+                    }
+
+                    for (auto& batch : batches) {
+                        asio::post(batch.shard->context, [msg, recipients = std::move(batch.recipients)]() {
+                            for (const auto& [client, lane] : recipients) {
+                                client->QueueOutgoing(msg, lane);
+                            }
+                        });
+                    }
                 }
+
+                return queued;
             }
 
-            // send a message to all clients
-            void MessageAllClients(const message<T>& msg, std::shared_ptr<connection<T>> ignore_client = nullptr) {
-                bool InvalidClientExists = false;
+            // handle what the io threads have received. not available with inline handlers,
+            // which run on the io thread as messages arrive.
+            // every connection with something waiting gets one turn per Update, in which it can use up to
+            // its quantum (deficit round robin), so a client flooding the server can't hold up the others
+            void Update(size_t MaxMessages = std::numeric_limits<size_t>::max(), bool wait = false) {
+                static_assert(!Threading::inline_handlers, "inline handlers run on the io thread, there is nothing to update");
+                if (wait && active.empty()) { messages_in.wait(); }
 
-                for (auto& client : deqConnections) {
-                    // check if client exists
-                    if (client && client->IsConnected()) {
-                        if (client != ignore_client) { client->Send(msg); }
-                    } else {
-                        // the client couldn't be contacted, so assume it has disconnected
-                        OnClientDisconnect(client);
-                        client.reset();
-                        InvalidClientExists = true;
+                // messages built during the last tick that have all been written free their arena here
+                outbound_arena.NextTick();
+
+                // connections whose inbound queue has stopped being empty join the end of the round
+                messages_in.drain([this](owned_message<T, Threading> msg) {
+                    active.push_back({std::move(msg.remote), 0});
+                });
+
+                size_t handled = 0;
+                for (size_t turns = active.size(); turns > 0 && handled < MaxMessages; turns--) {
+                    inbound_turn turn = std::move(active.front());
+                    active.pop_front();
+                    turn.deficit += inboundQuantum;
+
+                    bool more;
+                    bool resume = false;
+                    {
+                        auto& box = turn.client->Inbound;
+                        std::scoped_lock lock(box.mux);
+                        while (!box.items.empty() && handled < MaxMessages) {
+                            size_t cost = InboundCost(box.items.front());
+                            if (cost > turn.deficit) {
+                                break;
+                            }
+                            turn.deficit -= cost;
+                            taken.push_back(std::move(box.items.front()));
+                            box.items.pop_front();
+                            handled++;
+                        }
+
+                        // an idle connection doesn't keep credit, it drops out until it has something again
+                        more = !box.items.empty();
+                        if (!more) {
+                            box.scheduled = false;
+                        }
+                        if (turn.client->ReadPaused && box.items.size() <= turn.client->options.inbound_queue_length / 2) {
+                            turn.client->ReadPaused = false;
+                            resume = true;
+                        }
+                    }
+
+                    if (resume) {
+                        turn.client->ResumeReading();
+                    }
+                    if (more) {
+                        active.push_back(turn);
                     }
+
+                    for (auto& msg : taken) {
+                        Route(std::move(msg));
+                    }
+                    taken.clear();
                 }
 
-                // apparently it's bad to modify a container while using iterators to move through it,
-                // so we set a flag and edit accordingly
-                if (InvalidClientExists) {
-                    // remove takes unwanted element out of the container
-                    // and returns a container with empty spaces between elements extracted and moved to the end of the container,
-                    // where erase shaves the empty spaces off so that memory isn't wasted
-                    deqConnections.erase(
-                            std::remove(deqConnections.begin(), deqConnections.end(), nullptr),
-                             deqConnections.end());
+                FlushBatch();
+            }
+
+            // create an outbound message whose body (and shared control block, once sent) comes from the
+            // current tick's arena instead of the heap. only call this from the thread running Update
+            // (the io thread with inline handlers), e.g. inside OnMessage, and don't keep the message past
+            // the lifetime of the server. on a dispatch worker the message just uses the heap.
+            // sending it by reference shares a copy from the same arena, a plain copy of it uses the heap
+            message<T> CreateMessage(T id = T{}) {
+                message<T> msg;
+                msg.header.id = id;
+                if (!OnDispatchWorker) {
+                    msg.body = typename message<T>::body_type(outbound_arena.resource());
                 }
+                return msg;
             }
 
-            void Update(size_t MaxMessages = std::numeric_limits<size_t>::max(), bool wait = false) {
-                if (wait) { messages_in.wait(); }
+            // allocation counters for messages made with CreateMessage
+            const arena_stats& GetArenaStats() const {
+                return outbound_arena.Stats();
+            }
 
-                size_t MessageCount = 0;
-                while ((MessageCount < MaxMessages) && !messages_in.empty()) {
-                    // grab the latest message
-                    auto msg = messages_in.pop_front();
+            // received bodies are recycled through a size classed pool,
+            // this caps how many bytes of free buffers it keeps around
+            void SetBodyPoolLimit(size_t bytes) {
+                inbound_pool.SetRetainLimit(bytes);
+            }
 
-                    // pass to message handler
-                    OnMessage(msg.remote, msg.msg);
+            const pool_stats& GetBodyPoolStats() const {
+                return inbound_pool.Stats();
+            }
+
+            // choose the header format offered to clients, the compact format is only used with
+            // clients that ask for it during the handshake. takes effect for new connections
+            void SetWireFormat(wire_format format) {
+                options.format = format;
+            }
+
+            // limits on how many queued frames go out in one gathered write. takes effect for new connections
+            void SetWriteBatch(size_t maxBytes, size_t maxBuffers) {
+                options.write_batch_bytes = maxBytes;
+                options.write_batch_buffers = maxBuffers;
+            }
+
+            // size of each connection's receive buffer, every complete frame in it is parsed per read. takes effect for new connections
+            void SetReadBuffer(size_t bytes) {
+                options.read_buffer_size = bytes;
+            }
 
-                    MessageCount++;
+            // what happens to messages for a client that isn't keeping up. takes effect for new connections
+            void SetSlowConsumerPolicy(slow_consumer_policy policy) {
+                options.slow_consumer = policy;
+            }
+
+            // high and low water marks for each connection's outbound queue. takes effect for new connections
+            void SetOutboundLimits(size_t highBytes, size_t lowBytes, size_t highMessages, size_t lowMessages) {
+                options.outbound_high_bytes = highBytes;
+                options.outbound_low_bytes = lowBytes;
+                options.outbound_high_messages = highMessages;
+                options.outbound_low_messages = lowMessages;
+            }
+
+            // close a client that sends a frame with a bigger body than this, before anything is allocated for it.
+            // zero for no limit, bigger payloads can still come as streams. takes effect for new connections
+            void SetMaxFrameSize(size_t bytes) {
+                options.max_frame_size = bytes;
+            }
+
+            // how fast each client may send, and what happens to frames over the limit. a connection's own
+            // limit can be changed with its SetRateLimit, e.g. from OnClientValidated. takes effect for new connections
+            void SetRateLimit(const rate_limit& limit) {
+                options.inbound_limit = limit;
+            }
+
+            // the outbound lanes each client gets after the control lane (lane 0), one weight per bulk lane.
+            // the control lane always goes first, the bulk lanes share what is left by weight, quantum * weight
+            // bytes per turn. takes effect for new connections
+            void SetOutboundLanes(std::vector<uint32_t> bulkWeights, size_t quantum = 16 * 1024) {
+                options.bulk_lanes = std::move(bulkWeights);
+                options.lane_quantum = std::max<size_t>(quantum, 1);
+            }
+
+            // caps what the server writes per second, split evenly over the io threads since each one shapes its
+            // own connections. a connection with something to send gets its turns in proportion to its weight,
+            // quantum * weight bytes at a time, zero removes the cap. takes effect straight away
+            void SetEgressLimit(double bytesPerSec, size_t quantum = 16 * 1024) {
+                for (size_t i = 0; i < pool.size(); i++) {
+                    io_shard& shard = pool[i];
+                    asio::post(shard.context, [&shard, rate = bytesPerSec / double(pool.size()), quantum]() {
+                        shard.egress.SetLimit(rate, quantum);
+                    });
                 }
             }
 
-            // called when a client is validated
-            virtual void OnClientValidated(std::shared_ptr<connection<T>> client) {
+            // each client's share of the egress limit relative to the others, a connection's own weight can be
+            // changed with its SetEgressWeight, e.g. from OnClientValidated. takes effect for new connections
+            void SetEgressWeight(double weight) {
+                options.egress_weight = weight;
+            }
+
+            // how much each client may have handled per Update before the next client's turn, in messages or bytes.
+            // a message bigger than the quantum waits until the client has saved up enough turns
+            void SetInboundQuantum(size_t quantum, inbound_quantum unit = inbound_quantum::messages) {
+                inboundQuantum = std::max<size_t>(quantum, 1);
+                inboundUnit = unit;
+            }
+
+            // how many received messages a client may have waiting before its connection stops reading.
+            // takes effect for new connections
+            void SetInboundQueue(size_t length) {
+                options.inbound_queue_length = std::max<size_t>(length, 1);
+            }
+
+            // hand OnMessageBatch one run of messages per message id instead of everything in arrival order.
+            // each client's messages with the same id stay in order, but not relative to its other ids
+            void SetBatchGrouping(bool byId) {
+                groupBatches = byId;
+            }
+
+            // run handlers on this many worker threads instead of inside Update, 0 (the default) keeps them
+            // in Update. each client's messages are still handled one at a time and in order, different clients
+            // in parallel. quantum is how many of one client's messages a worker handles before moving on. call before Start,
+            // and have the derived server call Stop in its destructor so no worker is still inside one of its handlers
+            void SetDispatchWorkers(size_t workers, size_t quantum = 32) {
+                static_assert(!Threading::inline_handlers, "inline handlers always run on the io thread");
+                dispatchWorkers = workers;
+                dispatchQuantum = quantum;
+            }
+
+            const dispatch_stats& GetDispatchStats() const requires (!Threading::inline_handlers) {
+                return dispatcher.Stats();
+            }
+
+            // how accepted connections are spread over the io threads, used by the single acceptor
+            void SetShardPolicy(shard_policy policy) {
+                sharding = policy;
+            }
+
+            // one shared acceptor or one per io thread, and how many connections an acceptor takes
+            // per wakeup at most. call before Start
+            void SetAcceptMode(accept_mode mode, size_t batch = 64) {
+                acceptMode = mode;
+                acceptBatch = std::max<size_t>(batch, 1);
+            }
+
+            const accept_stats& GetAcceptStats() const {
+                return acceptStats;
+            }
+
+            // run fn on the io thread. with inline handlers this is how anything outside a handler
+            // (a timer, the console) must reach the server and its clients
+            template <typename F>
+            void Post(F fn) {
+                asio::post(pool.Primary().context, std::move(fn));
+            }
+
+            // how long a new client gets to finish the handshake, zero for no limit. takes effect for new connections
+            void SetHandshakeTimeout(std::chrono::milliseconds timeout) {
+                options.handshake_timeout = timeout;
+            }
+
+            // close a validated client that hasn't sent anything for this long, zero for never. takes effect for new connections
+            void SetIdleTimeout(std::chrono::milliseconds timeout) {
+                options.idle_timeout = timeout;
+            }
+
+            // send an empty message with this id to any client nothing has been written to for interval,
+            // clients that answer it keep themselves clear of the idle timeout. takes effect for new connections
+            void SetHeartbeat(std::chrono::milliseconds interval, T id) {
+                options.heartbeat_interval = interval;
+
+                message<T> msg;
+                msg.header.id = id;
+                heartbeat = make_shared_message(std::move(msg));
+            }
+
 
+            // called with the notify slow consumer policy when a message is sent to a congested client,
+            // on the thread that sent it. return true to queue the message anyway. during a broadcast the
+            // client list is locked, so don't message clients by id from here
+            virtual bool OnClientBackpressure([[maybe_unused]] std::shared_ptr<connection_type> client, [[maybe_unused]] const shared_message<T>& msg) {
+                return false;
             }
         protected:
             // called when a client connects, you can veto the connection by returning false
-            virtual bool OnClientConnect(std::shared_ptr<connection<T>> client) {
+            virtual bool OnClientConnect([[maybe_unused]] std::shared_ptr<connection_type> client) {
                 return false;
             }
 
-            // called when a client appears to have disconnected
-            virtual void OnClientDisconnect(std::shared_ptr<connection<T>> client) {
+            // called from Update when a client has finished the handshake, before any of its messages
+            virtual void OnClientValidated([[maybe_unused]] std::shared_ptr<connection_type> client) {
+
+            }
+
+            // called from Update when a validated client's connection has closed, for whatever reason
+            virtual void OnClientDisconnect([[maybe_unused]] std::shared_ptr<connection_type> client) {
 
             }
 
             // called when a message arrives
-            virtual void OnMessage(std::shared_ptr<connection<T>> client, message<T>& msg) {
+            virtual void OnMessage([[maybe_unused]] std::shared_ptr<connection_type> client, [[maybe_unused]] message<T>& msg) {
+
+            }
+
+            // called from Update with every message drained in one pass (or one run of them per id, see
+            // SetBatchGrouping), so a handler can work through them together. the default calls OnMessage
+            // for each. not used with dispatch workers or inline handlers, they call OnMessage directly
+            virtual void OnMessageBatch(std::span<owned_message<T, Threading>> messages) {
+                for (auto& msg : messages) {
+                    OnMessage(msg.remote, msg.msg);
+                }
+            }
+
+            // called for each chunk of a stream a client sends, in order with its messages and wherever OnMessage
+            // would run. data points into the received chunk, so copy out what has to outlive the call.
+            // chunks of a stream come in order, the one with last set ends it (with aborted set too if the client gave up on it)
+            virtual void OnStreamChunk([[maybe_unused]] std::shared_ptr<connection_type> client, [[maybe_unused]] T id, [[maybe_unused]] const stream_chunk& chunk) {
+
+            }
+
+            // with dispatch workers, return true for messages whose handler touches state shared between
+            // clients. those run one at a time on the global lane, as do OnClientValidated and OnClientDisconnect
+            virtual bool RequiresGlobalLane([[maybe_unused]] const std::shared_ptr<connection_type>& client, [[maybe_unused]] const message<T>& msg) {
+                return false;
+            }
+
+            // runs a message or lifecycle event, in Update, on a dispatch worker or on the io thread
+            void Handle(const std::shared_ptr<connection_type>& client, message<T>& msg, connection_event event) {
+                if constexpr (!Threading::inline_handlers) {
+                    OnDispatchWorker = dispatcher.Running();
+                }
+
+                bool received = event == connection_event::message || event == connection_event::chunk;
+                std::unique_lock<typename Threading::mutex> lane;
+                if (OnDispatchWorker && (!received || RequiresGlobalLane(client, msg))) {
+                    lane = std::unique_lock(muxGlobalLane);
+                }
+
+                switch (event) {
+                    case connection_event::validated:
+                        OnClientValidated(client);
+                        break;
+                    case connection_event::disconnect:
+                        OnClientDisconnect(client);
+                        break;
+                    case connection_event::message:
+                        OnMessage(client, msg);
+                        break;
+                    case connection_event::chunk:
+                        OnStreamChunk(client, msg.header.id, read_chunk(msg));
+                        break;
+                    default:
+                        break;
+                }
+            }
+
+            // Update - what a message or chunk counts for against its client's quantum, lifecycle events are free
+            size_t InboundCost(const owned_message<T, Threading>& msg) const {
+                if (msg.event != connection_event::message && msg.event != connection_event::chunk) {
+                    return 0;
+                }
+                return inboundUnit == inbound_quantum::bytes ? max_header_size<T> + msg.msg.body.size() : 1;
+            }
+
+            // Update - one message or lifecycle event taken from a client's inbound queue
+            void Route(owned_message<T, Threading>&& msg) {
+                // connections report their own lifecycle through their queue, in order with their messages.
+                // the client list is kept up to date here, the callbacks run with the client's messages
+                if (msg.event == connection_event::validated && !AddClient(msg.remote)) {
+                    return;
+                }
+                if (msg.event == connection_event::disconnect && !RemoveClient(msg.remote)) {
+                    return;
+                }
+
+                if (dispatcher.Running()) {
+                    dispatcher.Dispatch(std::move(msg));
+                    return;
+                }
+
+                // messages are collected for OnMessageBatch, a lifecycle callback or a chunk first hands over
+                // what has been collected so far so it still runs in order with the messages around it
+                if (msg.event == connection_event::message) {
+                    batch.push_back(std::move(msg));
+                    return;
+                }
+                FlushBatch();
+                Handle(msg.remote, msg.msg, msg.event);
+            }
+
+            // Update - pass the collected messages to OnMessageBatch. once it returns their bodies go back
+            // to inbound_pool, unless the handler moved them somewhere else
+            void FlushBatch() {
+                if (batch.empty()) {
+                    return;
+                }
+
+                if (groupBatches) {
+                    std::stable_sort(batch.begin(), batch.end(), [](const owned_message<T, Threading>& a, const owned_message<T, Threading>& b) {
+                        return a.msg.header.id < b.msg.header.id;
+                    });
+
+                    size_t start = 0;
+                    for (size_t i = 1; i <= batch.size(); i++) {
+                        if (i == batch.size() || batch[i].msg.header.id != batch[start].msg.header.id) {
+                            OnMessageBatch(std::span<owned_message<T, Threading>>(batch).subspan(start, i - start));
+                            start = i;
+                        }
+                    }
+                } else {
+                    OnMessageBatch(batch);
+                }
+
+                // keeps its capacity for the next pass
+                batch.clear();
+            }
+
+            // io thread - with inline handlers a connection calls this instead of queueing, in the same
+            // order Update would have seen it
+            void Deliver(const std::shared_ptr<connection_type>& client, message<T>& msg, connection_event event) {
+                if (event == connection_event::validated && !AddClient(client)) {
+                    return;
+                }
+                if (event == connection_event::disconnect && !RemoveClient(client)) {
+                    return;
+                }
+                Handle(client, msg, event);
+            }
 
+            // with inline handlers nothing calls Update, so the io thread moves the outbound arena on every tick
+            void ScheduleArenaTick() {
+                pool.Primary().timers.Schedule(1, [this]() {
+                    outbound_arena.NextTick();
+                    ScheduleArenaTick();
+                });
             }
 
-            // tsq for incoming message packets
-            tsqueue<owned_message<T>> messages_in;
+            void OpenAcceptors() {
+                asio::ip::tcp::endpoint endpoint(asio::ip::tcp::v4(), port);
+
+                size_t count = 1;
+#ifdef SO_REUSEPORT
+                if (acceptMode == accept_mode::reuse_port) {
+                    count = pool.size();
+                }
+#endif
 
-            // container of active validated connections
-            std::deque<std::shared_ptr<connection<T>>> deqConnections;
+                for (size_t i = 0; i < count; i++) {
+                    auto acceptor = std::make_unique<asio::ip::tcp::acceptor>(pool[i].context);
+                    acceptor->open(endpoint.protocol());
+                    acceptor->set_option(asio::ip::tcp::acceptor::reuse_address(true));
+#ifdef SO_REUSEPORT
+                    if (count > 1) {
+                        acceptor->set_option(reuse_port_option(true));
+                    }
+#endif
+                    acceptor->bind(endpoint);
+                    acceptor->listen();
+                    // only affects the synchronous accepts that drain a burst, they stop at would_block
+                    acceptor->non_blocking(true);
+                    acceptors.push_back(std::move(acceptor));
+                }
+            }
 
-            // context and thread to run it in
-            asio::io_context context;
-            std::thread context_thread;
+            // with an acceptor per io thread the connection stays on the acceptor's thread,
+            // a single acceptor hands connections out by the shard policy
+            io_shard& ShardFor(size_t acceptor) {
+                return acceptors.size() > 1 ? pool[acceptor] : pool.Pick(sharding);
+            }
 
-            // the acceptor waits for connections to accept
-            asio::ip::tcp::acceptor asio_acceptor;
+            // nothing here writes to the console, so a reconnect storm isn't held up by logging
+            void AcceptConnection(io_shard& shard, asio::ip::tcp::socket socket) {
+                std::shared_ptr<connection_type> newconn =
+                        std::make_shared<connection_type>(connection_type::owner::server,
+                                shard.context, std::move(socket), messages_in, options);
+
+                // give the user a chance to deny connection
+                if (OnClientConnect(newconn)) {
+                    // connection allowed. until it has validated it is kept alive by its own
+                    // pending handshake, and joins the live clients when Update sees it validate
+                    newconn->ConnectToClient(this, &shard, heartbeat);
+                    acceptStats.accepted.fetch_add(1, std::memory_order_relaxed);
+                } else {
+                    acceptStats.denied.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+
+            // the client's id comes from its slot in the registry, so it is only known once it has validated
+            bool AddClient(const std::shared_ptr<connection_type>& client) {
+                std::unique_lock lock(muxConnections);
+                if (connections.full()) {
+                    std::cout << "[-----] too many clients\n";
+                    client->Disconnect();
+                    return false;
+                }
+
+                client->id.store(connections.insert(client), std::memory_order_relaxed);
+                return true;
+            }
+
+            // removal swaps the last client into the gap, so it doesn't depend on how many clients there are
+            bool RemoveClient(const std::shared_ptr<connection_type>& client) {
+                std::unique_lock lock(muxConnections);
+                return connections.erase(client->GetID());
+            }
 
-            // clients will be identified in the system via an id
-            uint32_t id_counter = 10000;
+            // per tick arena for outbound message bodies and pool for received ones, declared first
+            // so that they outlive every queued message that still points into them
+            message_arena outbound_arena;
+            basic_buffer_pool<typename Threading::mutex> inbound_pool;
+
+            // io threads and their contexts. anything that can hold a connection is declared after them,
+            // so every socket is destroyed while its context is still there
+            io_pool pool;
+            shard_policy sharding = shard_policy::round_robin;
+
+            // lock-free queue the io threads use to tell Update a connection has messages waiting
+            typename connection_type::incoming_queue messages_in;
+
+            // connections with messages waiting, in round robin order, and the credit each has left
+            struct inbound_turn {
+                std::shared_ptr<connection_type> client;
+                size_t deficit;
+            };
+            std::deque<inbound_turn> active;
+
+            // the clients on one io thread a broadcast goes to, and the lane each one queues it on
+            struct broadcast_batch {
+                io_shard* shard;
+                std::vector<std::pair<std::shared_ptr<connection_type>, size_t>> recipients;
+            };
+            size_t inboundQuantum = 256;
+            inbound_quantum inboundUnit = inbound_quantum::messages;
+            std::vector<owned_message<T, Threading>> taken;
+
+            // the messages Update has drained but not yet handed to OnMessageBatch
+            std::vector<owned_message<T, Threading>> batch;
+            bool groupBatches = false;
+
+            // the acceptors wait for connections to accept, opened by Start
+            std::vector<std::unique_ptr<asio::ip::tcp::acceptor>> acceptors;
+            uint16_t port;
+            accept_mode acceptMode = accept_mode::single;
+            size_t acceptBatch = 64;
+            accept_stats acceptStats;
+
+            // live validated connections by id, packed in no particular order for broadcasts.
+            // changed by the thread running Update (the io thread with inline handlers), read by any handler
+            slot_map<std::shared_ptr<connection_type>> connections;
+            mutable typename Threading::shared_mutex muxConnections;
+
+            // optional workers running handlers in parallel, and the lock behind the global lane
+            std::conditional_t<Threading::inline_handlers, compiled_out, dispatch_pool<T>> dispatcher;
+            size_t dispatchWorkers = 0;
+            size_t dispatchQuantum = 32;
+            typename Threading::mutex muxGlobalLane;
+            static inline thread_local bool OnDispatchWorker = false;
+
+            // settings handed to every new connection
+            connection_options options;
+            shared_message<T> heartbeat;
+
+            friend class connection<T, Threading>;
         private:
 
         };
@@ -0,0 +1,142 @@
+// Created by psdab on 5/2/2024.
+
+#ifndef BETTER_SERVER_NET_SLOT_MAP_H
+#define BETTER_SERVER_NET_SLOT_MAP_H
+#pragma once
+
+#include "net_common.h"
+
+#include <span>
+#include <stdexcept>
+
+namespace ps {
+    namespace net {
+        // container that hands out a 32 bit id for each value it stores. the low bits of an id pick a slot
+        // and the high bits carry that slot's generation, which is bumped every time the slot is freed,
+        // so an id that outlived its value never finds whatever moved into the slot afterwards.
+        // values are kept packed in a dense array for iteration, and removing one moves the last value into its place.
+        // not thread safe
+        template <typename V>
+        class slot_map {
+        public:
+            static constexpr uint32_t slot_bits = 20;
+            static constexpr uint32_t max_slots = uint32_t(1) << slot_bits;
+            static constexpr uint32_t invalid_id = 0;
+
+            // stores value and returns its id, which is never invalid_id.
+            // throws std::length_error once every slot is in use
+            uint32_t insert(V value) {
+                uint32_t slot;
+                if (!freeSlots.empty()) {
+                    // freed slots are reused oldest first, so a generation takes as long as possible to come around again
+                    slot = freeSlots.front();
+                    freeSlots.pop_front();
+                } else if (slots.size() < max_slots) {
+                    slot = uint32_t(slots.size());
+                    slots.push_back({1, npos});
+                } else {
+                    throw std::length_error("slot_map is full");
+                }
+
+                slots[slot].dense = uint32_t(values.size());
+                values.push_back(std::move(value));
+                ids.push_back(make_id(slot, slots[slot].generation));
+                return ids.back();
+            }
+
+            // returns false if id isn't (or is no longer) in the map
+            bool erase(uint32_t id) {
+                uint32_t slot = slot_of(id);
+                if (!contains(id)) {
+                    return false;
+                }
+
+                uint32_t dense = slots[slot].dense;
+                uint32_t last = uint32_t(values.size() - 1);
+                if (dense != last) {
+                    values[dense] = std::move(values[last]);
+                    ids[dense] = ids[last];
+                    slots[slot_of(ids[dense])].dense = dense;
+                }
+                values.pop_back();
+                ids.pop_back();
+
+                // generation zero is skipped so no id ever comes out as invalid_id
+                slots[slot].dense = npos;
+                slots[slot].generation = (slots[slot].generation + 1) & generation_mask;
+                if (slots[slot].generation == 0) {
+                    slots[slot].generation = 1;
+                }
+                freeSlots.push_back(slot);
+                return true;
+            }
+
+            bool contains(uint32_t id) const {
+                uint32_t slot = slot_of(id);
+                return slot < slots.size() && slots[slot].dense != npos && slots[slot].generation == generation_of(id);
+            }
+
+            // nullptr if id isn't in the map
+            V* find(uint32_t id) {
+                return contains(id) ? &values[slots[slot_of(id)].dense] : nullptr;
+            }
+
+            const V* find(uint32_t id) const {
+                return contains(id) ? &values[slots[slot_of(id)].dense] : nullptr;
+            }
+
+            size_t size() const {
+                return values.size();
+            }
+
+            bool empty() const {
+                return values.empty();
+            }
+
+            bool full() const {
+                return freeSlots.empty() && slots.size() >= max_slots;
+            }
+
+            // the stored values and their ids, packed and in matching order.
+            // erasing invalidates both, so don't erase while walking them
+            std::span<V> dense_values() {
+                return values;
+            }
+
+            std::span<const uint32_t> dense_ids() const {
+                return ids;
+            }
+
+            auto begin() { return values.begin(); }
+            auto end() { return values.end(); }
+
+        private:
+            static constexpr uint32_t npos = std::numeric_limits<uint32_t>::max();
+            static constexpr uint32_t generation_mask = (uint32_t(1) << (32 - slot_bits)) - 1;
+
+            static uint32_t make_id(uint32_t slot, uint32_t generation) {
+                return (generation << slot_bits) | slot;
+            }
+
+            static uint32_t slot_of(uint32_t id) {
+                return id & (max_slots - 1);
+            }
+
+            static uint32_t generation_of(uint32_t id) {
+                return id >> slot_bits;
+            }
+
+            struct slot_entry {
+                uint32_t generation;
+                uint32_t dense;
+            };
+
+            std::vector<V> values;
+            std::vector<uint32_t> ids;
+            std::vector<slot_entry> slots;
+            std::deque<uint32_t> freeSlots;
+        };
+    }
+}
+
+#endif
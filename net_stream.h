@@ -0,0 +1,81 @@
+// Created by psdab on 5/2/2024.
+
+#ifndef BETTER_SERVER_NET_STREAM_H
+#define BETTER_SERVER_NET_STREAM_H
+#pragma once
+
+#include "net_common.h"
+#include "net_message.h"
+
+#include <span>
+#include <stdexcept>
+
+namespace ps {
+    namespace net {
+        // a payload too big to hold in one message goes out as a stream: a run of ordinary frames (chunks)
+        // with the top bit of the header's size set, each starting with its stream id and whether it is
+        // the last one. chunks queue like any other message, so other messages and lanes interleave with
+        // them, and the receiver handles each one as it arrives instead of assembling the whole payload.
+        // the flag means a plain message body has to stay under 2 GiB
+        constexpr uint32_t chunk_frame_flag = 0x80000000u;
+
+        // stream id (4 bytes) and flag byte in front of every chunk's data
+        constexpr size_t chunk_prefix_size = sizeof(uint32_t) + 1;
+
+        // the flag byte: more to come, the last chunk, or the sender gave up on the stream (which ends it too)
+        constexpr uint8_t chunk_more = 0;
+        constexpr uint8_t chunk_last = 1;
+        constexpr uint8_t chunk_aborted = 2;
+
+        // one received chunk, data points into the message it came in. an aborted stream ends with
+        // an empty chunk that has both last and aborted set
+        struct stream_chunk {
+            uint32_t stream = 0;
+            bool last = false;
+            bool aborted = false;
+            std::span<const uint8_t> data;
+        };
+
+        // a chunk frame's header and prefix, the length bytes of data that follow it on the wire aren't in the body
+        template <typename T>
+        message<T> make_chunk_prefix(T id, uint32_t stream, size_t length, uint8_t flag) {
+            message<T> msg;
+            msg.header.id = id;
+            msg.body.resize(chunk_prefix_size);
+            std::memcpy(msg.body.data(), &stream, sizeof(uint32_t));
+            msg.body.data()[sizeof(uint32_t)] = flag;
+            msg.header.size = uint32_t(chunk_prefix_size + length) | chunk_frame_flag;
+            return msg;
+        }
+
+        // a whole chunk frame ready to send
+        template <typename T>
+        message<T> make_chunk(T id, uint32_t stream, std::span<const uint8_t> data, bool last) {
+            message<T> msg = make_chunk_prefix(id, stream, 0, last ? chunk_last : chunk_more);
+            msg.body.resize(chunk_prefix_size + data.size());
+            if (!data.empty()) {
+                std::memcpy(msg.body.data() + chunk_prefix_size, data.data(), data.size());
+            }
+            msg.header.size = uint32_t(msg.body.size()) | chunk_frame_flag;
+            return msg;
+        }
+
+        // the chunk carried by a message that arrived as a connection_event::chunk
+        template <typename T>
+        stream_chunk read_chunk(const message<T>& msg) {
+            if (msg.body.size() < chunk_prefix_size) {
+                throw std::length_error("message is too short to be a chunk");
+            }
+
+            stream_chunk chunk;
+            std::memcpy(&chunk.stream, msg.body.data(), sizeof(uint32_t));
+            uint8_t flag = msg.body.data()[sizeof(uint32_t)];
+            chunk.last = flag != chunk_more;
+            chunk.aborted = flag == chunk_aborted;
+            chunk.data = std::span<const uint8_t>(msg.body.data() + chunk_prefix_size, msg.body.size() - chunk_prefix_size);
+            return chunk;
+        }
+    }
+}
+
+#endif
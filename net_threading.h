@@ -0,0 +1,48 @@
+// Created by psdab on 5/2/2024.
+
+#ifndef BETTER_SERVER_NET_THREADING_H
+#define BETTER_SERVER_NET_THREADING_H
+#pragma once
+
+#include "net_common.h"
+
+#include <shared_mutex>
+
+namespace ps {
+    namespace net {
+        // a lock that does nothing, for state a threading policy guarantees only one thread touches
+        struct null_mutex {
+            void lock() {}
+            bool try_lock() { return true; }
+            void unlock() {}
+
+            void lock_shared() {}
+            bool try_lock_shared() { return true; }
+            void unlock_shared() {}
+        };
+
+        // stands in for a member (a queue, a worker pool) that a threading policy doesn't need
+        struct compiled_out {};
+
+        // threading policies for server_interface and its connections, picked by template parameter.
+
+        // the io threads queue what they receive and the handlers run from Update on the application's
+        // thread (or on dispatch workers). handlers can block, at the cost of two thread hops per request
+        struct queued_dispatch {
+            static constexpr bool inline_handlers = false;
+            using mutex = std::mutex;
+            using shared_mutex = std::shared_mutex;
+        };
+
+        // the handlers run straight on the io thread that read the message and Send writes without posting,
+        // so a request is answered without ever leaving that thread. there is one io thread and no queue or
+        // locks at all, which means handlers must never block and nothing may touch the server from another thread
+        struct inline_dispatch {
+            static constexpr bool inline_handlers = true;
+            using mutex = null_mutex;
+            using shared_mutex = null_mutex;
+        };
+    }
+}
+
+#endif
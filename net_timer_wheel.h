@@ -0,0 +1,131 @@
+// Created by psdab on 5/2/2024.
+
+#ifndef BETTER_SERVER_NET_TIMER_WHEEL_H
+#define BETTER_SERVER_NET_TIMER_WHEEL_H
+#pragma once
+
+#include "net_common.h"
+
+#include <functional>
+
+namespace ps {
+    namespace net {
+        // hashed timing wheel: one steady_timer per io context ticks through a ring of slots, and every
+        // deadline belonging to that context sits in the slot its tick hashes to. scheduling and firing are
+        // O(1) however many connections there are, at the cost of only being accurate to one tick.
+        // everything except Start must happen on the thread running the context
+        class timing_wheel {
+        public:
+            using clock = std::chrono::steady_clock;
+
+            // slots is rounded up to a power of two. a deadline further away than one turn of the wheel
+            // just waits out the extra turns in its slot
+            explicit timing_wheel(asio::io_context& context, std::chrono::milliseconds resolution = std::chrono::milliseconds(100), size_t slots = 512)
+                    : timer(context), resolution(std::max(resolution, std::chrono::milliseconds(1))) {
+                size_t size = 1;
+                while (size < slots) {
+                    size <<= 1;
+                }
+                mask = size - 1;
+                wheel.resize(size);
+            }
+
+            timing_wheel(const timing_wheel&) = delete;
+            timing_wheel& operator=(const timing_wheel&) = delete;
+
+            // prime the context with the first tick, call before the context starts running
+            void Start() {
+                stopped = false;
+                next = clock::now();
+                Arm();
+            }
+
+            // nothing scheduled fires after this, it can be called from one of the callbacks
+            void Stop() {
+                stopped = true;
+                timer.cancel();
+            }
+
+            // ticks since the wheel started, cheap enough to stamp on every read
+            uint64_t Now() const {
+                return current;
+            }
+
+            // a duration rounded up to whole ticks, never less than one
+            uint64_t Ticks(std::chrono::milliseconds duration) const {
+                uint64_t ticks = uint64_t((duration.count() + resolution.count() - 1) / resolution.count());
+                return std::max<uint64_t>(ticks, 1);
+            }
+
+            // run fn once, the given number of ticks from now
+            void Schedule(uint64_t ticks, std::function<void()> fn) {
+                ticks = std::max<uint64_t>(ticks, 1);
+                // a slot is visited every wheel.size() ticks, the first time after (ticks - 1) % size + 1 of them
+                wheel[(current + ticks) & mask].push_back({(ticks - 1) / wheel.size(), std::move(fn)});
+            }
+
+            void Schedule(std::chrono::milliseconds delay, std::function<void()> fn) {
+                Schedule(Ticks(delay), std::move(fn));
+            }
+
+        private:
+            struct entry {
+                uint64_t rounds;
+                std::function<void()> fn;
+            };
+
+            void Arm() {
+                next += resolution;
+                timer.expires_at(next);
+                timer.async_wait([this](std::error_code ec) {
+                    if (ec || stopped) {
+                        return;
+                    }
+
+                    // catch up if the thread was busy for longer than a tick
+                    Advance();
+                    auto now = clock::now();
+                    while (!stopped && next + resolution <= now) {
+                        next += resolution;
+                        Advance();
+                    }
+
+                    // a callback may have stopped the wheel while there was no wait to cancel
+                    if (!stopped) {
+                        Arm();
+                    }
+                });
+            }
+
+            void Advance() {
+                current++;
+                auto& slot = wheel[current & mask];
+
+                // callbacks can schedule into the slot being walked, so walk a swapped out copy.
+                // the spare vector keeps its capacity between ticks
+                firing.swap(slot);
+                for (auto& e : firing) {
+                    if (e.rounds > 0) {
+                        e.rounds--;
+                        slot.push_back(std::move(e));
+                    } else {
+                        e.fn();
+                    }
+                }
+                firing.clear();
+            }
+
+            asio::steady_timer timer;
+            std::chrono::milliseconds resolution;
+            clock::time_point next;
+            bool stopped = false;
+
+            std::vector<std::vector<entry>> wheel;
+            std::vector<entry> firing;
+            size_t mask = 0;
+            uint64_t current = 0;
+        };
+    }
+}
+
+#endif
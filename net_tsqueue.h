@@ -36,7 +36,16 @@ namespace ps {
                 cvBlocking.notify_one();
             }
 
-            // adds element after the last element in the queue
+            // adds element after the last element in the queue, moving it in rather than copying
+            void push_back(T&& item) {
+                std::scoped_lock lock(muxQueue);
+                deqQueue.emplace_back(std::move(item));
+
+                std::unique_lock<std::mutex> ul(muxBlocking);
+                cvBlocking.notify_one();
+            }
+
+            // adds element before the first element in the queue
             void push_front(const T& item) {
                 std::scoped_lock lock(muxQueue);
                 deqQueue.emplace_front(std::move(item));
@@ -0,0 +1,74 @@
+// Created by psdab on 5/2/2024.
+
+#ifndef BETTER_SERVER_NET_VARINT_H
+#define BETTER_SERVER_NET_VARINT_H
+#pragma once
+
+#include "net_common.h"
+
+namespace ps {
+    namespace net {
+        // LEB128 variable length integers: 7 bits per byte, low bits first, and the top bit of
+        // each byte says whether another byte follows. values under 128 take a single byte
+        constexpr size_t max_varint_size = 10;
+
+        constexpr size_t varint_size(uint64_t value) {
+            size_t n = 1;
+            while (value >= 0x80) {
+                value >>= 7;
+                n++;
+            }
+            return n;
+        }
+
+        // returns one past the last byte written
+        inline uint8_t* write_varint(uint8_t* out, uint64_t value) {
+            while (value >= 0x80) {
+                *out++ = uint8_t(value) | 0x80;
+                value >>= 7;
+            }
+            *out++ = uint8_t(value);
+            return out;
+        }
+
+        // returns the number of bytes consumed, or 0 if the varint isn't complete within length bytes
+        inline size_t read_varint(const uint8_t* in, size_t length, uint64_t& value) {
+            value = 0;
+            for (size_t i = 0; i < length && i < max_varint_size; i++) {
+                value |= uint64_t(in[i] & 0x7f) << (7 * i);
+                if ((in[i] & 0x80) == 0) {
+                    return i + 1;
+                }
+            }
+            return 0;
+        }
+
+        // the same encoding with its bytes stored back to front, for fields that are pulled off the
+        // end of a message body (operator>>): reading backwards from the end meets the low bits first.
+        // returns one past the last byte written
+        inline uint8_t* write_varint_reversed(uint8_t* out, uint64_t value) {
+            uint8_t bytes[max_varint_size];
+            size_t n = size_t(write_varint(bytes, value) - bytes);
+            for (size_t i = 0; i < n; i++) {
+                out[i] = bytes[n - 1 - i];
+            }
+            return out + n;
+        }
+
+        // end points one past the last byte of the varint. returns the number of bytes consumed,
+        // or 0 if it doesn't terminate within length bytes
+        inline size_t read_varint_reversed(const uint8_t* end, size_t length, uint64_t& value) {
+            value = 0;
+            for (size_t i = 0; i < length && i < max_varint_size; i++) {
+                uint8_t byte = *(end - 1 - i);
+                value |= uint64_t(byte & 0x7f) << (7 * i);
+                if ((byte & 0x80) == 0) {
+                    return i + 1;
+                }
+            }
+            return 0;
+        }
+    }
+}
+
+#endif
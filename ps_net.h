@@ -5,9 +5,24 @@
 #pragma once
 
 #include "net_common.h"
+#include "net_buffer.h"
+#include "net_serialize.h"
+#include "net_byteorder.h"
+#include "net_varint.h"
+#include "net_arena.h"
+#include "net_pool.h"
 #include "net_message.h"
 #include "net_connection.h"
 #include "net_tsqueue.h"
+#include "net_mpsc_queue.h"
+#include "net_timer_wheel.h"
+#include "net_slot_map.h"
+#include "net_io_pool.h"
+#include "net_dispatch.h"
+#include "net_threading.h"
+#include "net_rate_limit.h"
+#include "net_egress.h"
+#include "net_stream.h"
 #include "net_client.h"
 #include "net_server.h"
 
@@ -0,0 +1,156 @@
+#include "ps_net.h"
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// a ping/echo server with inline handlers: every handler runs on the one io thread, replies go out without Update
+enum class TestMsg : uint32_t {
+    Ping,
+    Bye
+};
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond "\n"; \
+            failures++; \
+        } \
+    } while (0)
+
+class EchoServer : public ps::net::server_interface<TestMsg, ps::net::inline_dispatch> {
+public:
+    explicit EchoServer(uint16_t port) : ps::net::server_interface<TestMsg, ps::net::inline_dispatch>(port) {}
+
+    // the io thread stops before the counters below go away
+    ~EchoServer() override {
+        Stop();
+    }
+
+    std::atomic<int> validated{0};
+    std::atomic<int> disconnected{0};
+    std::atomic<int> pings{0};
+
+    // whether every handler ran on the same thread, which isn't the one that started the server
+    std::thread::id handlerThread;
+    std::atomic<bool> oneThread{true};
+
+protected:
+    bool OnClientConnect(std::shared_ptr<connection_type>) override {
+        Seen();
+        return true;
+    }
+
+    void OnClientValidated(std::shared_ptr<connection_type>) override {
+        Seen();
+        validated++;
+    }
+
+    void OnClientDisconnect(std::shared_ptr<connection_type>) override {
+        Seen();
+        disconnected++;
+    }
+
+    void OnMessage(std::shared_ptr<connection_type> client, ps::net::message<TestMsg>& msg) override {
+        Seen();
+        if (msg.header.id == TestMsg::Bye) {
+            client->Disconnect();
+            return;
+        }
+        pings++;
+        client->Send(ps::net::make_shared_message(std::move(msg)));
+    }
+
+private:
+    void Seen() {
+        if (handlerThread == std::thread::id()) {
+            handlerThread = std::this_thread::get_id();
+        } else if (handlerThread != std::this_thread::get_id()) {
+            oneThread = false;
+        }
+    }
+};
+
+template <typename F>
+static bool WaitFor(F&& done) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (!done()) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+static void EchoInOrder() {
+    constexpr size_t client_count = 3;
+    constexpr uint32_t pings = 2000;
+
+    // below the ephemeral ranges, so a client socket left in TIME_WAIT can't be holding the port
+    EchoServer server(30700);
+    CHECK(server.Start());
+
+    std::vector<std::unique_ptr<ps::net::client_interface<TestMsg>>> clients;
+    for (size_t i = 0; i < client_count; i++) {
+        clients.push_back(std::make_unique<ps::net::client_interface<TestMsg>>());
+        clients.back()->Connect("127.0.0.1", 30700);
+    }
+    CHECK(WaitFor([&]() { return server.validated == int(client_count); }));
+
+    // every client's pings come back complete and in the order they were sent
+    for (auto& client : clients) {
+        for (uint32_t i = 0; i < pings; i++) {
+            ps::net::message<TestMsg> msg;
+            msg.header.id = TestMsg::Ping;
+            msg << i;
+            client->Send(msg);
+        }
+    }
+    for (auto& client : clients) {
+        uint32_t next = 0;
+        bool ordered = true;
+        CHECK(WaitFor([&]() {
+            client->Incoming().drain([&](ps::net::owned_message<TestMsg>&& in) {
+                uint32_t i = 0;
+                in.msg >> i;
+                ordered = ordered && in.msg.header.id == TestMsg::Ping && i == next;
+                next++;
+            });
+            return next >= pings;
+        }));
+        CHECK(ordered && next == pings);
+    }
+    CHECK(server.pings == int(client_count * pings));
+
+    // the registry is the io thread's, so it is asked there
+    std::promise<size_t> count;
+    server.Post([&]() { count.set_value(server.ClientCount()); });
+    CHECK(count.get_future().get() == client_count);
+
+    // the server hangs up on each client, which it hears about on the io thread like everything else
+    for (auto& client : clients) {
+        ps::net::message<TestMsg> bye;
+        bye.header.id = TestMsg::Bye;
+        client->Send(bye);
+    }
+    CHECK(WaitFor([&]() { return server.disconnected == int(client_count); }));
+
+    CHECK(server.oneThread);
+    CHECK(server.handlerThread != std::this_thread::get_id());
+}
+
+int main() {
+    EchoInOrder();
+
+    if (failures > 0) {
+        std::cerr << failures << " check(s) failed\n";
+        return 1;
+    }
+    std::cout << "all inline dispatch checks passed\n";
+    return 0;
+}
@@ -0,0 +1,355 @@
+#include "ps_net.h"
+#include <iostream>
+#include <memory_resource>
+#include <span>
+#include <string_view>
+#include <vector>
+
+// message push/pull checks, a body from the remote can claim any count it likes
+enum class TestMsg : uint32_t {
+    Data
+};
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond "\n"; \
+            failures++; \
+        } \
+    } while (0)
+
+template <typename E, typename F>
+static bool throws(F fn) {
+    try {
+        fn();
+    } catch (const E&) {
+        return true;
+    }
+    return false;
+}
+
+// anything that may hold a pointer has to say what it carries before it can go on the wire
+struct NamedValue {
+    std::string_view name;
+    int x;
+};
+
+class Handle {
+    int* p = nullptr;
+};
+
+struct Vec3 {
+    float x, y, z;
+};
+
+struct Opaque {
+    Opaque() = default;
+    uint32_t a = 0;
+    uint32_t b = 0;
+};
+
+template <>
+struct ps::net::wire_opaque<Opaque> : std::true_type {};
+
+static_assert(!ps::net::is_wire_type<NamedValue>());
+static_assert(!ps::net::is_wire_type<std::span<int>>());
+static_assert(!ps::net::is_wire_type<Handle>());
+static_assert(!ps::net::is_wire_type<std::string_view>());
+static_assert(!ps::net::is_wire_type<int*>());
+static_assert(ps::net::is_wire_type<Vec3>());
+static_assert(ps::net::is_wire_type<std::array<Vec3, 4>>());
+static_assert(ps::net::is_wire_type<Opaque>());
+
+static void ArrayRoundTrip() {
+    ps::net::message<TestMsg> msg;
+    std::vector<int> out = {1, 2, 3, 4, 5};
+    msg << out;
+
+    std::vector<int> in;
+    msg >> in;
+    CHECK(in == out);
+    CHECK(msg.body.size() == 0);
+}
+
+static void OversizedArrayCount() {
+    // a count with nothing behind it
+    ps::net::message<TestMsg> msg;
+    msg << size_t{4096};
+
+    std::vector<int> in;
+    CHECK(throws<std::out_of_range>([&]() { msg >> in; }));
+    CHECK(in.empty());
+}
+
+static void TruncatedArray() {
+    // a count of 10 with only three elements in front of it
+    ps::net::message<TestMsg> msg;
+    int items[3] = {7, 8, 9};
+    msg << items;
+    msg << size_t{10};
+
+    std::vector<int> in;
+    CHECK(throws<std::out_of_range>([&]() { msg >> in; }));
+}
+
+static void HugeArrayCount() {
+    // count * element size wraps around
+    ps::net::message<TestMsg> msg;
+    msg << uint64_t{0};
+    msg << (std::numeric_limits<size_t>::max() / 4 + 2);
+
+    std::vector<int> in;
+    CHECK(throws<std::out_of_range>([&]() { msg >> in; }));
+}
+
+static void OversizedNetworkOrderArray() {
+    ps::net::message<TestMsg> msg;
+    msg << size_t{4096};
+
+    std::vector<uint32_t> in;
+    CHECK(throws<std::out_of_range>([&]() { msg >> ps::net::network_order(in); }));
+
+    // a fixed size array bigger than the body
+    ps::net::message<TestMsg> small;
+    small << uint16_t{1};
+    uint32_t fixed[4];
+    CHECK(throws<std::out_of_range>([&]() { small >> ps::net::network_order(fixed); }));
+}
+
+static void NetworkOrderRoundTrip() {
+    // 37 elements, so the vector paths leave a scalar tail
+    std::vector<uint16_t> shorts(37);
+    std::vector<uint32_t> words(37);
+    std::vector<uint64_t> longs(37);
+    for (size_t i = 0; i < 37; i++) {
+        shorts[i] = uint16_t(0x0102 + i);
+        words[i] = uint32_t(0x01020304u + i);
+        longs[i] = 0x0102030405060708ull + i;
+    }
+
+    ps::net::message<TestMsg> msg;
+    msg << ps::net::network_order(words);
+    CHECK(msg.body[0] == 0x01 && msg.body[1] == 0x02 && msg.body[2] == 0x03 && msg.body[3] == 0x04);
+    msg << ps::net::network_order(shorts) << ps::net::network_order(longs);
+
+    std::vector<uint16_t> shortsIn;
+    std::vector<uint32_t> wordsIn;
+    std::vector<uint64_t> longsIn;
+    msg >> ps::net::network_order(longsIn) >> ps::net::network_order(shortsIn) >> ps::net::network_order(wordsIn);
+    CHECK(shortsIn == shorts);
+    CHECK(wordsIn == words);
+    CHECK(longsIn == longs);
+    CHECK(msg.body.size() == 0);
+}
+
+static void PullFromEmptyBody() {
+    ps::net::message<TestMsg> msg;
+    uint64_t value = 0;
+    CHECK(throws<std::out_of_range>([&]() { msg >> value; }));
+
+    std::string str;
+    ps::net::message<TestMsg> lying;
+    lying << size_t{100};
+    CHECK(throws<std::out_of_range>([&]() { lying >> str; }));
+}
+
+static void OversizedCompactLengths() {
+    ps::net::message<TestMsg> msg;
+    msg << ps::net::compact(uint64_t{5000});
+    std::string str;
+    CHECK(throws<std::out_of_range>([&]() { msg >> ps::net::compact(str); }));
+
+    ps::net::message<TestMsg> array;
+    array << uint32_t{1} << ps::net::compact(uint64_t{1} << 62);
+    std::vector<uint32_t> items;
+    CHECK(throws<std::out_of_range>([&]() { array >> ps::net::compact(items); }));
+
+    ps::net::message<TestMsg> wide;
+    wide << ps::net::compact(uint64_t{70000});
+    uint16_t narrow = 0;
+    CHECK(throws<std::out_of_range>([&]() { wide >> ps::net::compact(narrow); }));
+}
+
+static void HugeReaderSpanCount() {
+    // a varint count of 2^62 uint32_t is 2^64 bytes, which wraps to nothing
+    ps::net::message<TestMsg> msg;
+    uint8_t count[ps::net::max_varint_size];
+    size_t used = size_t(ps::net::write_varint(count, uint64_t{1} << 62) - count);
+    msg.body.resize(used + 12);
+    std::memcpy(msg.body.data(), count, used);
+
+    ps::net::message_reader<TestMsg> reader(msg, ps::net::length_prefix::varint);
+    CHECK(throws<std::out_of_range>([&]() { reader.read_span<uint32_t>(); }));
+
+    // a fixed count one element past the end
+    ps::net::message<TestMsg> fixed;
+    ps::net::message_writer<TestMsg> writer(fixed);
+    writer << uint32_t{4} << uint32_t{1} << uint32_t{2} << uint32_t{3};
+    ps::net::message_reader<TestMsg> short_reader(fixed);
+    CHECK(throws<std::out_of_range>([&]() { short_reader.read_span<uint32_t>(); }));
+}
+
+static void ReaderWriterRoundTrip() {
+    for (auto lengths : {ps::net::length_prefix::fixed, ps::net::length_prefix::varint}) {
+        std::vector<uint16_t> shorts = {1, 2, 3};
+        std::vector<uint64_t> longs(200, 0x0102030405060708ull);
+
+        ps::net::message<TestMsg> msg;
+        ps::net::message_writer<TestMsg> writer(msg, lengths);
+        writer << uint32_t{42} << "name" << Vec3{1.0f, 2.0f, 3.0f};
+        // three shorts leave the longs to be padded out to their alignment
+        writer.write_span<uint16_t>(shorts);
+        writer.write_span<uint64_t>(longs);
+        writer.write_string("");
+        CHECK(msg.header.size == msg.body.size());
+
+        // the reader leaves the message alone, so it reads the same the second time round
+        ps::net::message_reader<TestMsg> reader(msg, lengths);
+        for (int pass = 0; pass < 2; pass++) {
+            CHECK(reader.read<uint32_t>() == 42);
+            CHECK(reader.read_string() == "name");
+            Vec3 v = reader.read<Vec3>();
+            CHECK(v.x == 1.0f && v.y == 2.0f && v.z == 3.0f);
+            auto shortsIn = reader.read_span<uint16_t>();
+            CHECK(std::vector<uint16_t>(shortsIn.begin(), shortsIn.end()) == shorts);
+            auto longsIn = reader.read_span<uint64_t>();
+            CHECK(reinterpret_cast<uintptr_t>(longsIn.data()) % alignof(uint64_t) == 0);
+            CHECK(std::vector<uint64_t>(longsIn.begin(), longsIn.end()) == longs);
+            CHECK(reader.read_string().empty());
+            CHECK(reader.empty());
+            CHECK(throws<std::out_of_range>([&]() { reader.read<uint8_t>(); }));
+            reader.rewind();
+        }
+        CHECK(msg.header.size == msg.body.size());
+    }
+}
+
+static void TruncatedReaderCounts() {
+    // a varint count cut off in the middle
+    ps::net::message<TestMsg> cut;
+    cut.body.resize(2);
+    cut.body[0] = 0x80;
+    cut.body[1] = 0x80;
+    ps::net::message_reader<TestMsg> cutReader(cut, ps::net::length_prefix::varint);
+    CHECK(throws<std::out_of_range>([&]() { cutReader.read_string(); }));
+
+    // a varint count that never ends, longer than any 64 bit value
+    ps::net::message<TestMsg> endless;
+    endless.body.resize(ps::net::max_varint_size + 4);
+    for (auto& b : endless.body) {
+        b = 0xff;
+    }
+    ps::net::message_reader<TestMsg> endlessReader(endless, ps::net::length_prefix::varint);
+    CHECK(throws<std::out_of_range>([&]() { endlessReader.read_span<uint8_t>(); }));
+
+    // half of a fixed count
+    ps::net::message<TestMsg> half;
+    half.body.resize(2);
+    ps::net::message_reader<TestMsg> halfReader(half);
+    CHECK(throws<std::out_of_range>([&]() { halfReader.read_string(); }));
+
+    // a string count one byte past what is there, in either prefix
+    for (auto lengths : {ps::net::length_prefix::fixed, ps::net::length_prefix::varint}) {
+        ps::net::message<TestMsg> msg;
+        ps::net::message_writer<TestMsg>(msg, lengths).write_string("abcd");
+        size_t full = msg.body.size();
+        CHECK(full > 4);
+        if (full > 4) {
+            msg.body.resize(full - 1);
+        }
+        ps::net::message_reader<TestMsg> reader(msg, lengths);
+        CHECK(throws<std::out_of_range>([&]() { reader.read_string(); }));
+    }
+
+    // the largest count a varint can hold, for a one byte element
+    ps::net::message<TestMsg> max;
+    uint8_t count[ps::net::max_varint_size];
+    size_t used = size_t(ps::net::write_varint(count, std::numeric_limits<uint64_t>::max()) - count);
+    max.body.resize(used + 8);
+    std::memcpy(max.body.data(), count, used);
+    ps::net::message_reader<TestMsg> maxReader(max, ps::net::length_prefix::varint);
+    CHECK(throws<std::out_of_range>([&]() { maxReader.read_span<uint8_t>(); }));
+}
+
+static void CompactHeaderOverflow() {
+    // a body length of 2^32 must not wrap into a different frame length
+    uint8_t wire[2 * ps::net::max_varint_size];
+    uint8_t* end = ps::net::write_varint(wire, uint64_t(TestMsg::Data));
+    end = ps::net::write_varint(end, uint64_t{1} << 32);
+
+    ps::net::message_header<TestMsg> header;
+    size_t used = ps::net::decode_header(wire, size_t(end - wire), ps::net::wire_format::compact, header);
+    CHECK(used == ps::net::malformed_header);
+
+    end = ps::net::write_varint(wire, uint64_t(TestMsg::Data));
+    end = ps::net::write_varint(end, 300);
+    used = ps::net::decode_header(wire, size_t(end - wire), ps::net::wire_format::compact, header);
+    CHECK(used == size_t(end - wire) && header.size == 300);
+}
+
+static void CopiedBodyLeavesResource() {
+    // a copy of a body from a resource only one thread may use goes to the heap, a shared copy keeps the resource
+    std::pmr::monotonic_buffer_resource arena;
+    ps::net::message<TestMsg> msg;
+    msg.body = ps::net::message<TestMsg>::body_type(&arena);
+    msg.body.resize(1000);
+    msg.body[999] = 7;
+
+    ps::net::message<TestMsg> copy = msg;
+    CHECK(copy.body.resource() == nullptr);
+    CHECK(copy.body.size() == 1000 && copy.body[999] == 7);
+
+    auto shared = ps::net::make_shared_copy(msg);
+    CHECK(shared->body.resource() == &arena);
+    CHECK(shared->body.size() == 1000 && shared->body[999] == 7);
+}
+
+static void OtherInlineSize() {
+    // a message can keep more (or less) of its body inline than the default, and pushes and pulls the same
+    ps::net::message<TestMsg, 256> msg;
+    CHECK(msg.body.capacity() == 256);
+    msg << std::string("name") << uint32_t(7);
+    std::vector<uint16_t> ids(100, 3);
+    msg << ids;
+    CHECK(msg.body.capacity() == 256);
+
+    auto shared = ps::net::make_shared_copy(msg);
+    ps::net::message<TestMsg, 256> copy = *shared;
+    std::vector<uint16_t> idsOut;
+    uint32_t x = 0;
+    std::string name;
+    copy >> idsOut >> x >> name;
+    CHECK(idsOut == ids && x == 7 && name == "name");
+
+    ps::net::message<TestMsg, 8> small;
+    ps::net::message_writer<TestMsg, 8>(small).write_string("a longer string than fits inline");
+    CHECK(small.body.capacity() > 8);
+    ps::net::message_reader<TestMsg, 8> reader(small);
+    CHECK(reader.read_string() == "a longer string than fits inline");
+}
+
+int main() {
+    ArrayRoundTrip();
+    OversizedArrayCount();
+    TruncatedArray();
+    HugeArrayCount();
+    OversizedNetworkOrderArray();
+    NetworkOrderRoundTrip();
+    PullFromEmptyBody();
+    OversizedCompactLengths();
+    HugeReaderSpanCount();
+    ReaderWriterRoundTrip();
+    TruncatedReaderCounts();
+    CompactHeaderOverflow();
+    CopiedBodyLeavesResource();
+    OtherInlineSize();
+
+    if (failures > 0) {
+        std::cerr << failures << " check(s) failed\n";
+        return 1;
+    }
+    std::cout << "all message checks passed\n";
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include "net_mpsc_queue.h"
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// mpsc_queue checks, each producer's items have to come out in the order it pushed them, full ring or not
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond "\n"; \
+            failures++; \
+        } \
+    } while (0)
+
+struct item {
+    uint32_t producer;
+    uint64_t sequence;
+};
+
+static void FillAndDrain() {
+    // 5 is rounded up to 8
+    ps::net::mpsc_queue<int> queue(5);
+    CHECK(queue.empty());
+    for (int i = 0; i < 8; i++) {
+        queue.push_back(i);
+    }
+    CHECK(queue.count() == 8);
+    CHECK(queue.front() == 0);
+
+    // popping a lap's worth and pushing again goes round the ring in order
+    for (int lap = 0; lap < 3; lap++) {
+        for (int i = 0; i < 8; i++) {
+            CHECK(queue.pop_front() == lap * 8 + i);
+            queue.push_back((lap + 1) * 8 + i);
+        }
+    }
+    int expected = 24;
+    size_t drained = queue.drain([&](int x) { CHECK(x == expected++); });
+    CHECK(drained == 8);
+    CHECK(queue.empty() && queue.count() == 0);
+}
+
+static void OrderedWhenFull() {
+    // a ring far smaller than what is pushed, and a consumer that starts late, so producers keep finding it full
+    constexpr size_t producers = 4;
+    constexpr uint64_t each = 50000;
+    ps::net::mpsc_queue<item> queue(16);
+
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < producers; p++) {
+        threads.emplace_back([&queue, p]() {
+            for (uint64_t i = 0; i < each; i++) {
+                queue.push_back({uint32_t(p), i});
+            }
+        });
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (queue.count() < 16 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK(queue.count() == 16);
+
+    std::vector<uint64_t> next(producers, 0);
+    bool ordered = true;
+    for (uint64_t received = 0; received < producers * each; received++) {
+        // slow down now and then so the ring fills up again
+        if (received % 1000 == 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        queue.wait();
+        item x = queue.pop_front();
+        ordered = ordered && x.producer < producers && x.sequence == next[x.producer]++;
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    CHECK(ordered);
+    for (size_t p = 0; p < producers; p++) {
+        CHECK(next[p] == each);
+    }
+    CHECK(queue.empty());
+}
+
+int main() {
+    FillAndDrain();
+    OrderedWhenFull();
+
+    if (failures > 0) {
+        std::cerr << failures << " check(s) failed\n";
+        return 1;
+    }
+    std::cout << "all mpsc queue checks passed\n";
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include "ps_net.h"
+#include <iostream>
+#include <vector>
+
+// slot_map checks, an id that outlived its value must never reach whatever took its slot
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond "\n"; \
+            failures++; \
+        } \
+    } while (0)
+
+static uint32_t SlotOf(uint32_t id) {
+    return id & (ps::net::slot_map<int>::max_slots - 1);
+}
+
+static uint32_t GenerationOf(uint32_t id) {
+    return id >> ps::net::slot_map<int>::slot_bits;
+}
+
+static void InsertFindErase() {
+    ps::net::slot_map<int> map;
+    uint32_t a = map.insert(1);
+    uint32_t b = map.insert(2);
+    uint32_t c = map.insert(3);
+    CHECK(a != ps::net::slot_map<int>::invalid_id);
+    CHECK(map.size() == 3);
+    CHECK(*map.find(b) == 2);
+
+    // removing the first moves the last into its place, ids still find their own values
+    CHECK(map.erase(a));
+    CHECK(!map.erase(a));
+    CHECK(map.find(a) == nullptr);
+    CHECK(*map.find(b) == 2 && *map.find(c) == 3);
+    CHECK(map.size() == 2);
+
+    auto values = map.dense_values();
+    auto ids = map.dense_ids();
+    CHECK(values.size() == ids.size());
+    for (size_t i = 0; i < ids.size(); i++) {
+        CHECK(*map.find(ids[i]) == values[i]);
+    }
+
+    CHECK(map.find(ps::net::slot_map<int>::invalid_id) == nullptr);
+}
+
+static void StaleIdAfterReuse() {
+    ps::net::slot_map<int> map;
+    uint32_t a = map.insert(1);
+    uint32_t b = map.insert(2);
+
+    // freed slots come back oldest first
+    map.erase(a);
+    map.erase(b);
+    uint32_t c = map.insert(3);
+    uint32_t d = map.insert(4);
+    CHECK(SlotOf(c) == SlotOf(a) && SlotOf(d) == SlotOf(b));
+
+    // same slots, new generations, so the old ids find nothing
+    CHECK(c != a && d != b);
+    CHECK(!map.contains(a) && !map.contains(b));
+    CHECK(map.find(a) == nullptr);
+    CHECK(!map.erase(b));
+    CHECK(*map.find(c) == 3 && *map.find(d) == 4);
+}
+
+static void GenerationWrap() {
+    // one slot freed and taken over and over walks its generation all the way round
+    ps::net::slot_map<int> map;
+    uint32_t first = map.insert(0);
+    constexpr uint32_t generations = (uint32_t(1) << (32 - ps::net::slot_map<int>::slot_bits)) - 1;
+
+    uint32_t id = first;
+    for (uint32_t i = 1; i < generations; i++) {
+        map.erase(id);
+        uint32_t next = map.insert(int(i));
+        CHECK(SlotOf(next) == SlotOf(first));
+        CHECK(GenerationOf(next) == GenerationOf(id) + 1);
+        CHECK(!map.contains(id));
+        id = next;
+    }
+    CHECK(GenerationOf(id) == generations);
+
+    // past the last generation it comes back to 1, never to 0, so slot 0 never hands out invalid_id
+    map.erase(id);
+    uint32_t wrapped = map.insert(-1);
+    CHECK(GenerationOf(wrapped) == 1);
+    CHECK(wrapped != ps::net::slot_map<int>::invalid_id);
+    CHECK(wrapped == first);
+    CHECK(!map.contains(id));
+    CHECK(*map.find(wrapped) == -1);
+}
+
+int main() {
+    InsertFindErase();
+    StaleIdAfterReuse();
+    GenerationWrap();
+
+    if (failures > 0) {
+        std::cerr << failures << " check(s) failed\n";
+        return 1;
+    }
+    std::cout << "all slot map checks passed\n";
+    return 0;
+}
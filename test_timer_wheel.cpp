@@ -0,0 +1,136 @@
+#include "ps_net.h"
+#include <iostream>
+#include <memory>
+#include <vector>
+
+// timing_wheel checks, on a wheel small enough that most deadlines wrap round it at least once
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond "\n"; \
+            failures++; \
+        } \
+    } while (0)
+
+struct firing {
+    uint64_t due;
+    uint64_t fired = 0;
+};
+
+// runs the wheel until a callback stops it and cancels limit, or for at most a few seconds
+template <typename F>
+static void Run(asio::io_context& context, ps::net::timing_wheel& wheel, F&& setup) {
+    asio::steady_timer limit(context, std::chrono::seconds(5));
+    limit.async_wait([&](std::error_code ec) {
+        if (!ec) {
+            std::cerr << "timing wheel didn't finish\n";
+            failures++;
+            context.stop();
+        }
+    });
+    asio::post(context, [&]() { setup(limit); });
+    wheel.Start();
+    context.run();
+}
+
+static void FiresOnItsTick() {
+    // 4 slots, so anything more than 4 ticks away goes round the wheel first
+    asio::io_context context;
+    ps::net::timing_wheel wheel(context, std::chrono::milliseconds(1), 4);
+
+    std::vector<firing> timers;
+    for (uint64_t ticks : {1, 2, 3, 4, 5, 7, 8, 9, 12, 13, 40}) {
+        timers.push_back({ticks});
+    }
+    size_t pending = timers.size();
+
+    Run(context, wheel, [&](asio::steady_timer& limit) {
+        for (auto& t : timers) {
+            wheel.Schedule(t.due - wheel.Now(), [&]() {
+                t.fired = wheel.Now();
+                if (--pending == 0) {
+                    wheel.Stop();
+                    limit.cancel();
+                }
+            });
+        }
+    });
+
+    // however late the io thread got to it, a deadline fires on the tick it was due and not a turn early or late
+    for (auto& t : timers) {
+        CHECK(t.fired == t.due);
+    }
+}
+
+static void RescheduleFromCallback() {
+    // a callback scheduling a whole turn ahead lands in the very slot that is being walked
+    asio::io_context context;
+    ps::net::timing_wheel wheel(context, std::chrono::milliseconds(1), 4);
+
+    std::vector<uint64_t> fired;
+    std::function<void()> again;
+    Run(context, wheel, [&](asio::steady_timer& limit) {
+        again = [&]() {
+            fired.push_back(wheel.Now());
+            if (fired.size() < 5) {
+                wheel.Schedule(4, again);
+            } else {
+                wheel.Stop();
+                limit.cancel();
+            }
+        };
+        wheel.Schedule(3, again);
+    });
+
+    CHECK(fired.size() == 5);
+    for (size_t i = 0; i < fired.size(); i++) {
+        CHECK(fired[i] == 3 + 4 * i);
+    }
+}
+
+static void Cancelled() {
+    // there is no cancel on the wheel, a deadline is dropped the way connections drop theirs,
+    // by the callback finding its owner gone. Stop drops everything still waiting
+    asio::io_context context;
+    ps::net::timing_wheel wheel(context, std::chrono::milliseconds(1), 4);
+
+    auto owner = std::make_shared<int>(0);
+    bool ranForOwner = false;
+    bool afterStop = false;
+    bool stopped = false;
+
+    Run(context, wheel, [&](asio::steady_timer& limit) {
+        wheel.Schedule(6, [&, weak = std::weak_ptr<int>(owner)]() {
+            if (weak.lock()) {
+                ranForOwner = true;
+            }
+        });
+        wheel.Schedule(2, [&]() { owner.reset(); });
+        wheel.Schedule(9, [&]() {
+            stopped = true;
+            wheel.Stop();
+            limit.cancel();
+        });
+        wheel.Schedule(10, [&]() { afterStop = true; });
+        wheel.Schedule(13, [&]() { afterStop = true; });
+    });
+
+    CHECK(stopped);
+    CHECK(!ranForOwner);
+    CHECK(!afterStop);
+}
+
+int main() {
+    FiresOnItsTick();
+    RescheduleFromCallback();
+    Cancelled();
+
+    if (failures > 0) {
+        std::cerr << failures << " check(s) failed\n";
+        return 1;
+    }
+    std::cout << "all timing wheel checks passed\n";
+    return 0;
+}